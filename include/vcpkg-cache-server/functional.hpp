@@ -11,6 +11,11 @@
 #include <charconv>
 #include <chrono>
 #include <filesystem>
+#include <list>
+#include <memory>
+#include <new>
+#include <span>
+#include <vector>
 
 #include <fmt/format.h>
 #include <fmt/chrono.h>
@@ -196,6 +201,153 @@ inline std::pair<std::string_view, std::string_view> parseAuthHeader(
     return {scheme, token};
 }
 
+/* Check a comma separated list of entity tags from an If-None-Match or If-Range header against
+ * the quoted etag. With weak comparison W/ prefixes are ignored, with strong comparison weak tags
+ * never match. A "*" matches any etag.
+ */
+constexpr bool matchesETag(std::string_view header, std::string_view etag, bool weak = true) {
+    while (!header.empty()) {
+        const auto [item, rest] = splitByFirst(header, ',');
+        header = rest;
+        auto tag = trim(item);
+        if (tag == "*") return true;
+        if (tag.starts_with("W/")) {
+            if (!weak) continue;
+            tag.remove_prefix(2);
+        }
+        if (tag == etag) return true;
+    }
+    return false;
+}
+
+/* A read only memory mapping of a whole file. Throws if the file can not be mapped */
+class MappedFile {
+public:
+    explicit MappedFile(const std::filesystem::path& path);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& rhs) noexcept;
+    MappedFile& operator=(MappedFile&& rhs) noexcept;
+    ~MappedFile();
+
+    std::span<const char> data() const { return {ptr, length}; }
+    size_t size() const { return length; }
+
+private:
+    const char* ptr = nullptr;
+    size_t length = 0;
+};
+
+/* Hint the OS to start reading the pages of a memory mapped range ahead of their use */
+void prefetch(std::span<const char> data);
+
+/* Flush a file or the entries of a directory to the disk. Throws if the flush fails */
+void syncFile(const std::filesystem::path& path);
+
+/* Flush many files or directories to the disk at once, the paths are flushed in parallel.
+ * Returns the error of each path, null if it was flushed.
+ */
+std::vector<std::exception_ptr> syncAll(std::span<const std::filesystem::path> paths);
+
+/* False for network and user space file systems, where a memory mapping faults if the file is
+ * truncated by another host. Unknown file systems count as local.
+ */
+bool isLocalFileSystem(const std::filesystem::path& path);
+
+/* Writes a new file through one large buffer, the data reaches the file in few big writes. If
+ * the final size is known the space is allocated up front to keep the file contiguous. With
+ * direct the data bypasses the page cache where the OS supports it, then all data goes through
+ * the buffer and only whole blocks are written until the file is closed. With append the data
+ * is added to an existing file and direct is ignored, its end is not aligned to a block. Throws
+ * if the file can not be written.
+ */
+class OutputFile {
+public:
+    static constexpr size_t blockSize = 4096;
+
+    OutputFile(const std::filesystem::path& path, std::optional<size_t> expectedSize,
+               size_t bufferSize, bool direct, bool append = false);
+    OutputFile(const OutputFile&) = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+    ~OutputFile();
+
+    void write(std::span<const char> data);
+    /* Write out the buffer as far as possible, returns the number of bytes in the file */
+    size_t flush();
+    /* Write the rest of the buffer and close the file */
+    void close();
+    /* Close the file without writing the buffer */
+    void discard() noexcept;
+
+    bool isOpen() const;
+    size_t size() const { return inFile + used; }
+
+private:
+    void writeOut(size_t length);
+    void writeAll(std::span<const char> data);
+
+    struct AlignedDelete {
+        void operator()(char* ptr) const { ::operator delete[](ptr, std::align_val_t{blockSize}); }
+    };
+
+    std::filesystem::path path;
+    std::unique_ptr<char[], AlignedDelete> buffer;
+    size_t capacity = 0;
+    size_t used = 0;
+    size_t inFile = 0;
+    bool direct = false;
+#if defined(_WIN32)
+    void* handle = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+/* A least recently used cache of at most capacity items, not thread safe */
+template <typename V>
+class LruCache {
+public:
+    explicit LruCache(size_t capacity) : capacity{capacity} {}
+
+    std::optional<V> get(std::string_view key) {
+        if (auto it = index.find(key); it != index.end()) {
+            items.splice(items.begin(), items, it->second);
+            return it->second->second;
+        } else {
+            return std::nullopt;
+        }
+    }
+
+    void put(std::string_view key, V value) {
+        if (auto it = index.find(key); it != index.end()) {
+            it->second->second = std::move(value);
+            items.splice(items.begin(), items, it->second);
+            return;
+        }
+        if (capacity == 0) return;
+        items.emplace_front(std::string{key}, std::move(value));
+        index.emplace(std::string{key}, items.begin());
+        if (items.size() > capacity) {
+            index.erase(items.back().first);
+            items.pop_back();
+        }
+    }
+
+    void erase(std::string_view key) {
+        if (auto it = index.find(key); it != index.end()) {
+            items.erase(it->second);
+            index.erase(it);
+        }
+    }
+
+    size_t size() const { return items.size(); }
+
+private:
+    size_t capacity;
+    std::list<std::pair<std::string, V>> items;
+    UnorderedStringMap<typename std::list<std::pair<std::string, V>>::iterator> index;
+};
+
 std::optional<size_t> openFileDescriptors();
 std::optional<size_t> threadCount();
 std::optional<size_t> memoryUsageBytes();
@@ -298,6 +450,8 @@ struct convert<std::chrono::duration<Rep, Period>> {
         const auto minutes = duration_cast<c::minutes>(d);
         d -= minutes;
         const auto seconds = duration_cast<c::seconds>(d);
+        d -= seconds;
+        const auto milliseconds = duration_cast<c::milliseconds>(d);
 
         std::string res;
         if (years != c::years{}) {
@@ -315,6 +469,9 @@ struct convert<std::chrono::duration<Rep, Period>> {
         if (seconds != c::seconds{}) {
             fmt::format_to(std::back_inserter(res), "{:%Q}s ", seconds);
         }
+        if (milliseconds != c::milliseconds{}) {
+            fmt::format_to(std::back_inserter(res), "{:%Q}ms ", milliseconds);
+        }
 
         return Node{res};
     }
@@ -331,13 +488,15 @@ struct convert<std::chrono::duration<Rep, Period>> {
         std::string_view rest = val;
         std::string_view current;
 
-        c::seconds res{};
+        c::milliseconds res{};
         while (!rest.empty()) {
             std::tie(current, rest) = vcache::fp::splitByFirst(rest);
             const auto tval = vcache::fp::trim(current);
             using vcache::fp::remove_suffix;
-            auto [str, factor] = [&]() -> std::pair<std::string_view, std::chrono::seconds> {
-                if (tval.ends_with("y")) {
+            auto [str, factor] = [&]() -> std::pair<std::string_view, std::chrono::milliseconds> {
+                if (tval.ends_with("ms")) {
+                    return {remove_suffix(tval, 2), c::milliseconds{1}};
+                } else if (tval.ends_with("y")) {
                     return {remove_suffix(tval, 1), c::years{1}};
                 } else if (tval.ends_with("d")) {
                     return {remove_suffix(tval, 1), c::days{1}};
@@ -359,7 +518,7 @@ struct convert<std::chrono::duration<Rep, Period>> {
             res += count * factor;
         }
 
-        duration = res;
+        duration = c::duration_cast<std::chrono::duration<Rep, Period>>(res);
         return true;
     }
 };
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vcpkg-cache-server/store.hpp>
+
+#include <filesystem>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace vcache {
+
+/* The index file is a compact binary snapshot of all the Infos of a store, used to avoid
+ * extracting every zip file again on restart. All data is stored in fixed size records that
+ * reference a shared, deduplicated string table, so it can be used directly from a memory mapping.
+ * Entries are validated against the size and modification time of the zip file by the caller.
+ */
+std::string encodeIndex(std::span<const Info* const> infos);
+std::vector<Info> decodeIndex(std::span<const char> data);
+
+/* Read the index from a memory mapping of file, or without map into memory, for network file
+ * systems where a mapping faults if the file is truncated remotely
+ */
+std::vector<Info> readIndex(const std::filesystem::path& file, bool map = true);
+/* Atomically replace file with the encoded index data, the new index is on disk on return */
+void writeIndex(const std::filesystem::path& file, std::string_view data);
+
+}  // namespace vcache
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vcpkg-cache-server/functional.hpp>
+
+#include <array>
+#include <atomic>
+#include <concepts>
+#include <initializer_list>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace vcache {
+
+/* A thread safe pool of deduplicated strings. Interned strings are never released, the returned
+ * views stay valid for the lifetime of the pool.
+ */
+class StringPool {
+public:
+    StringPool() = default;
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+
+    std::string_view intern(std::string_view str);
+
+    size_t size() const;
+    ByteSize bytes() const;
+
+    /* The pool shared by all the infos of the process */
+    static StringPool& global();
+
+private:
+    struct Shard {
+        mutable std::shared_mutex mtx;
+        fp::UnorderedStringSet strings;
+    };
+    std::array<Shard, 16> shards;
+    std::atomic<size_t> count{0};
+    std::atomic<size_t> totalBytes{0};
+};
+
+using StringPair = std::pair<std::string_view, std::string_view>;
+
+/* An immutable map of interned strings, stored as a flat vector of pairs sorted by key.
+ * On duplicate keys the first one is kept, like inserting into a std::map.
+ */
+class StringMap {
+public:
+    using key_type = std::string_view;
+    using mapped_type = std::string_view;
+    using value_type = StringPair;
+    using const_iterator = std::vector<value_type>::const_iterator;
+    using iterator = const_iterator;
+
+    StringMap() = default;
+    StringMap(std::initializer_list<value_type> items, StringPool& pool = StringPool::global());
+    template <std::ranges::input_range R>
+        requires(!std::same_as<std::remove_cvref_t<R>, StringMap>)
+    explicit StringMap(R&& range, StringPool& pool = StringPool::global()) {
+        for (auto&& [key, value] : range) {
+            items.emplace_back(pool.intern(key), pool.intern(value));
+        }
+        sortAndDeduplicate();
+    }
+    /* Construct a map without interning, the referenced strings have to outlive the map */
+    static StringMap fromViews(std::vector<value_type> items);
+
+    const_iterator begin() const { return items.begin(); }
+    const_iterator end() const { return items.end(); }
+    size_t size() const { return items.size(); }
+    bool empty() const { return items.empty(); }
+    std::span<const value_type> pairs() const { return items; }
+
+    const_iterator find(std::string_view key) const;
+
+    friend bool operator==(const StringMap& lhs, const StringMap& rhs) = default;
+
+private:
+    void sortAndDeduplicate();
+    std::vector<value_type> items;
+};
+
+}  // namespace vcache
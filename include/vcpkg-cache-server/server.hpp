@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vcpkg-cache-server/database.hpp>
+#include <vcpkg-cache-server/settings.hpp>
+#include <vcpkg-cache-server/staging.hpp>
+#include <vcpkg-cache-server/store.hpp>
+
+#include <httplib.h>
+
+#include <spdlog/spdlog.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace vcache {
+
+/* Check the write authorization of req, returns 200 or the status of the rejection */
+int authorize(const Authorization& auth, const httplib::Request& req, httplib::Response& res);
+
+httplib::Server::HandlerWithContentReader authorizeRequest(
+    const Authorization& auth, httplib::Server::HandlerWithContentReader handler);
+
+/* The user and token of the Authorization header of req, "-" if there are none */
+std::pair<std::string, std::string> requestUserToken(const httplib::Request& req,
+                                                     const Authorization& auth);
+
+int getOrAddCacheId(db::Database& db, const Info& info);
+void recordDownload(db::Database& db, const httplib::Request& req, const Info& info,
+                    const Authorization& auth);
+void recordUpload(db::Database& db, const httplib::Request& req, const Info& info,
+                  const Authorization& auth);
+
+void logCache(spdlog::logger& logger, const httplib::Request& req, const Info& info,
+              const Authorization& auth);
+
+/* What the handlers of the cache routes work on, all of it outlives the server */
+struct CacheService {
+    Store& store;
+    db::Database& db;
+    // Serializes the writes to db, the maintenance holds it for its whole transaction
+    std::mutex& dbMutex;
+    const Authorization& auth;
+    std::shared_ptr<spdlog::logger> logger;
+};
+
+/* The answer to Expect: 100-continue, uploads that would be refused are rejected with their
+ * status before the body is sent. Returns 100 to receive the body.
+ */
+int expectContinue(const CacheService& service, const httplib::Request& req,
+                   httplib::Response& res);
+void setExpectContinueHandler(httplib::Server& server, const CacheService& service);
+
+/* GET and HEAD of /cache/<sha>, the download route used by vcpkg */
+void addDownloadRoute(httplib::Server& server, const CacheService& service);
+/* The resumable uploads of /upload, their sessions are kept in staging */
+void addUploadRoutes(httplib::Server& server, const CacheService& service, Staging& staging);
+/* POST of /cache/exists, answers which of a list of caches exist */
+void addExistsRoute(httplib::Server& server, const CacheService& service);
+/* POST of /cache/bundle, downloads a list of caches as a single tar stream */
+void addBundleRoute(httplib::Server& server, const CacheService& service);
+/* POST of /cache/batch, uploads a tar stream of caches. At most one commit per core runs at a
+ * time over all batches.
+ */
+void addBatchRoute(httplib::Server& server, const CacheService& service);
+
+}  // namespace vcache
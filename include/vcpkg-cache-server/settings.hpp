@@ -4,7 +4,11 @@
 
 #include <spdlog/spdlog.h>
 
+#include <chrono>
 #include <filesystem>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
 
 namespace vcache {
 
@@ -29,6 +33,51 @@ struct ThreadPool {
     std::optional<size_t> maxQueuedRequests = std::nullopt;
 };
 
+/* When an upload is synced to disk before it is published. Group syncs the uploads of all
+ * writers together once every group commit interval.
+ */
+enum class Durability { None, Fsync, Group };
+
+constexpr std::string_view enumToStr(Durability durability) {
+    switch (durability) {
+        case Durability::None:
+            return "none";
+        case Durability::Fsync:
+            return "fsync";
+        case Durability::Group:
+            return "group";
+        default:
+            throw std::runtime_error("Invalid Durability enum");
+    }
+}
+
+template <>
+struct enumTo<Durability> {
+    using enum Durability;
+    static constexpr std::optional<Durability> operator()(std::string_view str) {
+        if (str == enumToStr(None)) {
+            return None;
+        } else if (str == enumToStr(Fsync)) {
+            return Fsync;
+        } else if (str == enumToStr(Group)) {
+            return Group;
+        } else {
+            return std::nullopt;
+        }
+    }
+};
+
+struct Storage {
+    std::optional<size_t> scanThreads = std::nullopt;
+    size_t detailsCacheSize = 4096;
+    Duration missCacheTtl = std::chrono::seconds{10};
+    Duration uploadSessionTtl = std::chrono::days{1};
+    ByteSize uploadBufferSize = ByteSize{4'000'000};
+    bool directUploads = false;
+    Durability durability = Durability::None;
+    Duration groupCommitInterval = std::chrono::milliseconds{10};
+};
+
 struct Settings {
     std::filesystem::path cacheDir{};
     std::filesystem::path dbFile;
@@ -42,6 +91,7 @@ struct Settings {
 
     Maintenance maintenance;
     ThreadPool threadPool;
+    Storage storage;
 };
 
 Settings parseArgs(int argc, char* argv[]);
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <compare>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace vcache {
+
+/* A decoded 32 byte sha256 digest, the key of every cache */
+struct Sha {
+    std::array<std::uint8_t, 32> bytes{};
+
+    /* Parse a 64 character lower case hex string, the form used in the cache file names */
+    static std::optional<Sha> parse(std::string_view hex);
+    /* The lower case hex representation */
+    std::string str() const;
+
+    friend auto operator<=>(const Sha&, const Sha&) = default;
+};
+
+/* Parse a list of shas separated by white space or commas, nullopt if any of them is invalid */
+std::optional<std::vector<Sha>> parseShas(std::string_view text);
+
+struct ShaHash {
+    std::size_t operator()(const Sha& sha) const {
+        // The digest is already uniformly distributed. Skip the first bytes, they are used to pick
+        // the store shard and are the same for all the keys of a shard.
+        std::size_t hash;
+        std::memcpy(&hash, sha.bytes.data() + 8, sizeof(hash));
+        return hash;
+    }
+};
+
+/* An open addressing hash map with linear probing keyed by Sha. Elements are stored inline in a
+ * single array that grows and shrinks with the number of elements, references and iterators are
+ * invalidated by any insertion or removal.
+ */
+template <typename V>
+class ShaMap {
+public:
+    using key_type = Sha;
+    using mapped_type = V;
+    using value_type = std::pair<Sha, V>;
+
+    template <bool Const>
+    class Iterator {
+    public:
+        using Map = std::conditional_t<Const, const ShaMap, ShaMap>;
+        using value_type = ShaMap::value_type;
+        using reference = std::conditional_t<Const, const value_type&, value_type&>;
+        using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::forward_iterator_tag;
+
+        Iterator() = default;
+        Iterator(Map* map, std::size_t index) : map{map}, index{index} { skip(); }
+        operator Iterator<true>() const
+            requires(!Const)
+        {
+            return {map, index};
+        }
+
+        reference operator*() const { return map->slots[index]; }
+        pointer operator->() const { return &map->slots[index]; }
+        Iterator& operator++() {
+            ++index;
+            skip();
+            return *this;
+        }
+        Iterator operator++(int) {
+            auto res = *this;
+            ++*this;
+            return res;
+        }
+        friend bool operator==(const Iterator& a, const Iterator& b) {
+            return a.index == b.index;
+        }
+
+    private:
+        void skip() {
+            while (index < map->used.size() && !map->used[index]) ++index;
+        }
+        Map* map = nullptr;
+        std::size_t index = 0;
+    };
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    ShaMap() = default;
+
+    std::size_t size() const { return count; }
+    std::size_t capacity() const { return slots.size(); }
+    bool empty() const { return count == 0; }
+
+    iterator begin() { return {this, 0}; }
+    iterator end() { return {this, used.size()}; }
+    const_iterator begin() const { return {this, 0}; }
+    const_iterator end() const { return {this, used.size()}; }
+
+    iterator find(const Sha& key) {
+        const auto [index, found] = locate(key);
+        return found ? iterator{this, index} : end();
+    }
+    const_iterator find(const Sha& key) const {
+        const auto [index, found] = locate(key);
+        return found ? const_iterator{this, index} : end();
+    }
+    bool contains(const Sha& key) const { return locate(key).second; }
+
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const Sha& key, Args&&... args) {
+        if ((count + 1) * 10 > slots.size() * 7) {
+            rehash(std::max(std::size_t{16}, slots.size() * 2));
+        }
+        const auto [index, found] = locate(key);
+        if (found) return {iterator{this, index}, false};
+
+        slots[index] = value_type{std::piecewise_construct, std::forward_as_tuple(key),
+                                  std::forward_as_tuple(std::forward<Args>(args)...)};
+        used[index] = 1;
+        ++count;
+        return {iterator{this, index}, true};
+    }
+
+    std::size_t erase(const Sha& key) {
+        auto [index, found] = locate(key);
+        if (!found) return 0;
+
+        // Backward shift deletion, move following entries of the probe sequence into the hole so
+        // lookups never need tombstones
+        const auto mask = slots.size() - 1;
+        for (auto next = (index + 1) & mask; used[next]; next = (next + 1) & mask) {
+            const auto home = ShaHash{}(slots[next].first) & mask;
+            const bool stays =
+                index <= next ? (index < home && home <= next) : (index < home || home <= next);
+            if (!stays) {
+                slots[index] = std::move(slots[next]);
+                index = next;
+            }
+        }
+        slots[index] = value_type{};
+        used[index] = 0;
+        --count;
+
+        // Give the memory back once the map has mostly been emptied
+        if (slots.size() > 16 && count * 5 < slots.size()) {
+            rehash(slots.size() / 2);
+        }
+        return 1;
+    }
+
+    void reserve(std::size_t size) {
+        auto capacity = std::size_t{16};
+        while (size * 10 > capacity * 7) capacity *= 2;
+        if (capacity > slots.size()) rehash(capacity);
+    }
+
+    void clear() {
+        slots.clear();
+        used.clear();
+        count = 0;
+    }
+
+private:
+    /* The slot of key if found, or the empty slot where it would be inserted */
+    std::pair<std::size_t, bool> locate(const Sha& key) const {
+        if (slots.empty()) return {0, false};
+        const auto mask = slots.size() - 1;
+        for (auto index = ShaHash{}(key) & mask;; index = (index + 1) & mask) {
+            if (!used[index]) return {index, false};
+            if (slots[index].first == key) return {index, true};
+        }
+    }
+
+    void rehash(std::size_t capacity) {
+        auto oldSlots = std::exchange(slots, std::vector<value_type>(capacity));
+        auto oldUsed = std::exchange(used, std::vector<std::uint8_t>(capacity, 0));
+        count = 0;
+        for (std::size_t i = 0; i < oldSlots.size(); ++i) {
+            if (oldUsed[i]) {
+                const auto [index, found] = locate(oldSlots[i].first);
+                slots[index] = std::move(oldSlots[i]);
+                used[index] = 1;
+                ++count;
+            }
+        }
+    }
+
+    std::vector<value_type> slots;
+    std::vector<std::uint8_t> used;
+    std::size_t count = 0;
+};
+
+}  // namespace vcache
+
+template <>
+struct fmt::formatter<vcache::Sha> : fmt::formatter<std::string_view> {
+    template <typename FormatContext>
+    auto format(const vcache::Sha& sha, FormatContext& ctx) const {
+        return fmt::formatter<std::string_view>::format(sha.str(), ctx);
+    }
+};
@@ -2,6 +2,7 @@
 
 #include <vcpkg-cache-server/functional.hpp>
 #include <vcpkg-cache-server/database.hpp>
+#include <vcpkg-cache-server/intern.hpp>
 #include <string>
 #include <string_view>
 #include <optional>
@@ -10,6 +11,7 @@
 #include <tuple>
 #include <map>
 #include <ranges>
+#include <span>
 
 #include <fmt/format.h>
 #include <fmt/ranges.h>
@@ -71,16 +73,19 @@ std::string downloads(db::Database& db, Mode mode, std::optional<size_t> sortIdx
 std::string index(const Store& store, db::Database& db, Mode mode, Sort sort,
                   std::optional<Order> order, std::string_view search);
 
-std::string statusData();
-std::string status(Mode mode);
+std::string statusData(const Store& store);
+std::string status(const Store& store, Mode mode);
 
 namespace detail {
 
 std::string deliver(std::string_view content, Mode mode);
 std::string nav(const std::vector<std::pair<std::string, std::string>>& path = {});
 
+/* The maps are expected to be sorted by key */
+size_t missmatches(std::span<const StringPair> map1, std::span<const StringPair> map2);
 size_t missmatches(const std::map<std::string, std::string>& map1,
                    const std::map<std::string, std::string>& map2);
+std::string formatDiff(std::span<const StringPair> dstMap, std::span<const StringPair> srcMap);
 std::string formatDiff(const std::map<std::string, std::string>& dstMap,
                        const std::map<std::string, std::string>& srcMap);
 std::string formatMap(const std::map<std::string, std::string>& range);
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vcpkg-cache-server/functional.hpp>
+#include <vcpkg-cache-server/sha.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace vcache {
+
+/* A resumable upload of a single cache. The data received so far is kept in a file in the
+ * staging directory, its size is the offset where the upload continues.
+ */
+struct UploadSession {
+    std::string id;
+    Sha sha;
+    std::filesystem::path path;
+    // Serializes the requests of the session, only one chunk is written at a time
+    std::mutex mtx;
+    // Set under mtx once the session is removed
+    bool closed = false;
+};
+
+/* The resumable upload sessions. The files are named <sha>.<id>.part, sessions are restored from
+ * them on construction and survive a restart. Sessions without a new chunk for ttl are removed.
+ */
+class Staging {
+public:
+    Staging(std::filesystem::path aDir, Duration aTtl, std::shared_ptr<spdlog::logger> aLog);
+    Staging(const Staging&) = delete;
+    Staging& operator=(const Staging&) = delete;
+
+    std::shared_ptr<UploadSession> create(const Sha& sha);
+    std::shared_ptr<UploadSession> find(std::string_view id) const;
+    /* Forget the session and remove its file if it is still there, the caller holds the lock
+     * of the session
+     */
+    void remove(UploadSession& session);
+
+    /* Remove the sessions that expired */
+    void prune();
+
+    const std::filesystem::path& directory() const { return dir; }
+
+private:
+    std::filesystem::path dir;
+    Duration ttl;
+    std::shared_ptr<spdlog::logger> logger;
+
+    mutable std::mutex mtx;
+    std::map<std::string, std::shared_ptr<UploadSession>, std::less<>> sessions;
+};
+
+}  // namespace vcache
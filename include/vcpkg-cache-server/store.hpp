@@ -1,6 +1,9 @@
 #pragma once
 
 #include <vcpkg-cache-server/functional.hpp>
+#include <vcpkg-cache-server/intern.hpp>
+#include <vcpkg-cache-server/sha.hpp>
+#include <vcpkg-cache-server/settings.hpp>
 
 #include <fstream>
 #include <spdlog/spdlog.h>
@@ -8,11 +11,22 @@
 #include <filesystem>
 #include <string_view>
 #include <ranges>
+#include <span>
 #include <map>
+#include <optional>
 #include <string>
 #include <mutex>
 #include <shared_mutex>
 #include <memory>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <stop_token>
+#include <thread>
+#include <vector>
 
 namespace vcache {
 
@@ -25,102 +39,425 @@ struct Info {
     std::string package{};
     std::string version{};
     std::string arch{};
-    std::string sha{};
-    std::map<std::string, std::string> ctrl{};
-    std::map<std::string, std::string> abi{};
+    Sha sha{};
     Time time{};
     std::size_t size{};
 };
 
-enum class InfoState { Valid, Writing, Deleted };
+/* The CONTROL and abi info of a cache. Only a few pages need them, so they are loaded from the
+ * zip file on demand instead of being kept in memory for every cache.
+ */
+class Details {
+public:
+    Details(std::string ctrlText, std::string abiText);
+    Details(const Details&) = delete;
+    Details& operator=(const Details&) = delete;
+
+    const StringMap& ctrl() const { return ctrlMap; }
+    const StringMap& abi() const { return abiMap; }
+
+private:
+    // The keys of the maps are interned, the values reference the texts
+    std::string ctrlText;
+    std::string abiText;
+    StringMap ctrlMap;
+    StringMap abiMap;
+};
+
+enum class InfoState { Valid, Writing, Deleting };
 
 Info extractInfo(const std::filesystem::path& path);
+/* The info of a cache that is not named after its sha */
+Info extractInfo(const std::filesystem::path& path, const Sha& sha);
+std::shared_ptr<const Details> extractDetails(const std::filesystem::path& path);
+
+/* Progress of a running scan, updated by the scan workers */
+struct ScanProgress {
+    std::atomic<size_t> total{0};
+    std::atomic<size_t> processed{0};
+    std::atomic<size_t> reused{0};
+    std::atomic<size_t> failed{0};
+    std::atomic<size_t> bytes{0};
+};
+
+/* Scans path for zip files and extracts their info using a pool of worker threads.
+ * Entries in known with a matching file size and modification time are reused instead of being
+ * extracted again. Extracted infos are passed in batches to found, and files that fail to extract
+ * are passed to failed.
+ */
+void scan(const std::filesystem::path& path, size_t threads, ShaMap<Info> known,
+          ScanProgress& progress, const std::function<void(std::vector<Info>&&)>& found,
+          const std::function<void(const std::filesystem::path&)>& failed,
+          std::shared_ptr<spdlog::logger> log, std::stop_token stop = {});
 
-fp::UnorderedStringMap<std::pair<InfoState, Info>> scan(const std::filesystem::path& path,
-                                                        std::shared_ptr<spdlog::logger> log);
+/* Scans path and collects all infos, files that fail to extract are removed */
+ShaMap<std::pair<InfoState, Info>> scan(const std::filesystem::path& path, size_t threads,
+                                        ShaMap<Info> known, std::shared_ptr<spdlog::logger> log);
+
+struct ScanStatus {
+    bool done;
+    size_t total;
+    size_t processed;
+    size_t reused;
+    size_t failed;
+    ByteSize bytes;
+    std::chrono::duration<double> elapsed;
+};
 
 class StoreWriter;
 class StoreReader;
+class StoreTail;
+
+/* The progress of a cache that is being uploaded, shared by its writer and the readers that
+ * follow the upload. Everything up to written has been flushed to the file.
+ */
+class Upload {
+public:
+    enum class State { Running, Committed, Failed };
+
+    Upload(std::filesystem::path path, std::filesystem::path target,
+           std::optional<size_t> expectedSize)
+        : path{std::move(path)}, target{std::move(target)}, expectedSize{expectedSize} {}
+
+    const std::filesystem::path path;
+    // Where the file is renamed to on commit, the upload is followed there until it is published
+    const std::filesystem::path target;
+    const std::optional<size_t> expectedSize;
+
+    void advance(size_t written);
+    void finish(State state, size_t written);
+
+    /* Block until more than offset bytes are written, the upload ended or timeout passed.
+     * Returns the written size and the state.
+     */
+    std::pair<size_t, State> wait(size_t offset, std::chrono::steady_clock::duration timeout) const;
 
+    /* Followers make the writer flush every write instead of batching them */
+    std::atomic<size_t> followers{0};
+
+private:
+    mutable std::mutex mtx;
+    mutable std::condition_variable changed;
+    size_t written = 0;
+    State state = State::Running;
+};
+
+/* Syncs uploads to disk before they are published, according to the durability setting. In
+ * group mode a background thread collects the files of all waiting writers for an interval and
+ * flushes them together with fp::syncAll.
+ */
+class Syncer {
+public:
+    Syncer(Durability durability, Duration interval);
+    Syncer(const Syncer&) = delete;
+    Syncer& operator=(const Syncer&) = delete;
+
+    /* Block until the file or directory is on disk, throws if it could not be synced */
+    void sync(const std::filesystem::path& path);
+
+private:
+    struct Request {
+        std::filesystem::path path;
+        std::exception_ptr error = nullptr;
+        bool done = false;
+    };
+
+    void run(std::stop_token stop);
+
+    Durability durability;
+    Duration interval;
+    std::mutex mtx;
+    std::condition_variable_any changed;
+    std::vector<std::shared_ptr<Request>> pending;
+    // Declared last to make sure the thread is stopped before any other member is destroyed
+    std::jthread thread;
+};
+
+/* A view that keeps the data it references alive */
 template <typename T>
-struct WrapWithLock : T {
-    WrapWithLock(std::shared_mutex& m, T t)
-        : T{t}, lock{std::make_shared<std::shared_lock<std::shared_mutex>>(m)} {}
+struct KeepAlive : T {
+    KeepAlive(std::shared_ptr<const void> data, T t) : T{std::move(t)}, data{std::move(data)} {}
 
 private:
-    std::shared_ptr<std::shared_lock<std::shared_mutex>> lock;
+    std::shared_ptr<const void> data;
 };
 
 template <typename T>
-WrapWithLock(T t) -> WrapWithLock<T>;
+KeepAlive(std::shared_ptr<const void>, T t) -> KeepAlive<T>;
 
+using InfoList = std::vector<std::shared_ptr<const Info>>;
+
+/* Running totals of the valid caches of a package */
+struct PackageSummary {
+    std::string name;
+    size_t count = 0;
+    size_t size = 0;
+    Time first = Time::max();
+    Time last = Time::min();
+};
+
+struct StoreTotals {
+    size_t caches;
+    size_t packages;
+    size_t size;
+};
+
+/* The Store keeps track of all the caches in the cache root. On construction a scan of the cache
+ * root is started in the background, while it is running caches that have not yet been reached
+ * are looked up on demand.
+ * Uploads are written to the .uploads directory of the cache root and renamed into place once
+ * they are complete and valid, a crash never leaves a partial cache behind.
+ */
 class Store {
 public:
-    Store(const std::filesystem::path& aRoot, std::shared_ptr<spdlog::logger> aLog);
+    Store(const std::filesystem::path& aRoot, const Storage& storage,
+          std::shared_ptr<spdlog::logger> aLog);
+    Store(const Store&) = delete;
+    Store& operator=(const Store&) = delete;
+    ~Store() = default;
+
+    bool exists(const Sha& sha) const;
+    /* The sha is in the index, as a valid cache or one that is being written or removed. Only
+     * the index is checked, a write of a known sha is rejected.
+     */
+    bool known(const Sha& sha) const;
 
-    bool exists(std::string_view sha) const;
+    std::shared_ptr<const Info> info(const Sha& sha);
+    std::shared_ptr<const Info> info(const Sha& sha) const;
+    /* The valid infos of shas in the same order, nullptr for the ones not in the index. No file
+     * system access is done.
+     */
+    InfoList infos(std::span<const Sha> shas) const;
 
-    const Info* info(std::string_view sha);
-    const Info* info(std::string_view sha) const;
+    /* The details are loaded on demand and kept in a bounded LRU cache */
+    std::shared_ptr<const Details> details(const Sha& sha) const;
 
-    std::shared_ptr<StoreReader> read(std::string_view sha);
-    std::shared_ptr<StoreWriter> write(std::string_view sha);
+    std::shared_ptr<StoreReader> read(const Sha& sha);
+    /* Follow a cache that is currently being uploaded, nullptr if there is no such upload */
+    std::shared_ptr<StoreTail> tail(const Sha& sha);
+    /* Start writing a new cache, nullptr if the sha already exists or is being written.
+     * expectedSize is the announced size of the upload, if known, for readers following it.
+     */
+    std::shared_ptr<StoreWriter> write(const Sha& sha,
+                                       std::optional<size_t> expectedSize = std::nullopt);
+    /* Add a cache that was received elsewhere, it is moved into place without going through an
+     * upload that readers could follow. staged has to be on the same file system as the cache
+     * root. Returns nullptr if the sha already exists or is being written, throws if staged is
+     * not a valid cache.
+     */
+    std::shared_ptr<const Info> commit(const Sha& sha, const std::filesystem::path& staged);
 
+    /* An immutable snapshot of all the valid infos. No locks are held while iterating, changes
+     * made after taking the snapshot are not visible in it.
+     */
     auto allInfos() const {
-        return WrapWithLock{smtx, infos | std::views::filter([](const auto& item) {
-                                      return item.second.first == InfoState::Valid;
-                                  }) | std::views::transform([](const auto& item) -> const Info& {
-                                      return item.second.second;
-                                  })};
+        auto parts = std::make_shared<const std::vector<std::shared_ptr<const InfoList>>>(
+            shards | std::views::transform(&Shard::validInfos) | std::ranges::to<std::vector>());
+        const auto deref = [](const auto& ptr) -> decltype(auto) { return *ptr; };
+        auto view = *parts | std::views::transform(deref) | std::views::join |
+                    std::views::transform(deref);
+        return KeepAlive{std::move(parts), std::move(view)};
     }
 
+    /* The valid infos of package, optionally only the ones built for arch. Only the caches of
+     * the package are visited.
+     */
+    InfoList packageInfos(std::string_view package,
+                          std::optional<std::string_view> arch = std::nullopt) const;
+
+    /* The summaries and totals are updated on every change, no caches are visited */
+    std::vector<PackageSummary> packageSummaries() const;
+    StoreTotals totals() const;
+
+    size_t size() const;
+
     std::string statistics() const;
 
-    void remove(std::string_view sha);
+    void remove(const Sha& sha);
+
+    /* Sync a file written outside of the store, like an upload chunk, according to the
+     * durability setting
+     */
+    void sync(const std::filesystem::path& path) { syncer.sync(path); }
+    /* Settings for writing files outside of the store */
+    size_t bufferSize() const { return uploadBufferSize; }
+
+    /* Write all valid infos to the index file in the cache root, the index is used to speed up
+     * the scan on the next start.
+     */
+    void saveIndex() const;
+    std::filesystem::path indexFile() const;
+
+    ScanStatus scanStatus() const;
+    /* Block until the initial scan has finished, returns false if stop was requested first */
+    bool waitForScan(std::stop_token stop = {}) const;
 
 private:
     friend StoreWriter;
     friend StoreReader;
+    friend StoreTail;
     struct Token {};
 
-    std::filesystem::path shaToPath(std::string_view sha) const;
+    /* The infos are split into shards by the first byte of the sha, matching the directory
+     * layout of the cache root, each shard synchronizes reading and writing to its infos.
+     * Infos are shared with their readers, removing an entry from a shard only drops the
+     * reference of the shard.
+     * Readers of all the infos use a copy on write list of the valid infos of each shard, any
+     * change of a valid entry must call invalidate while holding the lock.
+     * No file system access is done while holding the lock, the Writing and Deleting states
+     * reserve a sha while its file is worked on.
+     */
+    struct Shard {
+        mutable std::shared_mutex mtx;
+        ShaMap<std::pair<InfoState, std::shared_ptr<const Info>>> infos;
+        // Shas recently not found on disk, with the time until the miss is trusted
+        ShaMap<std::chrono::steady_clock::time_point> misses;
+        // The running uploads of the entries in the Writing state
+        ShaMap<std::shared_ptr<Upload>> uploads;
+
+        std::shared_ptr<const InfoList> validInfos() const;
+        void invalidate();
+        void addMiss(const Sha& sha, std::chrono::steady_clock::time_point until);
 
-    /* smtx synchronizes read and writing to infos.
-     * We make sure to never remove any info items to prevent the need of synchronization.
+    private:
+        mutable std::mutex snapshotMutex;
+        mutable std::shared_ptr<const InfoList> snapshot;
+    };
+
+    /* Secondary index of the valid infos by package and arch. It is updated together with the
+     * shards while holding the shard lock, its own lock is always taken last.
      */
-    mutable std::shared_mutex smtx;
+    class PackageIndex {
+    public:
+        void add(const std::shared_ptr<const Info>& info);
+        void remove(const Info& info);
+        InfoList find(std::string_view package, std::optional<std::string_view> arch) const;
+        std::vector<PackageSummary> summaries() const;
+        StoreTotals totals() const;
+
+    private:
+        struct Package {
+            size_t summary;  // Position in table
+            fp::UnorderedStringMap<ShaMap<std::shared_ptr<const Info>>> archs;
+        };
+
+        mutable std::shared_mutex mtx;
+        fp::UnorderedStringMap<Package> packages;
+        // The summaries are kept in one contiguous table, listing them is a single copy
+        std::vector<PackageSummary> table;
+        size_t totalCount = 0;
+        size_t totalSize = 0;
+    };
+
+    Shard& shard(const Sha& sha) { return shards[sha.bytes[0]]; }
+    const Shard& shard(const Sha& sha) const { return shards[sha.bytes[0]]; }
+
+    std::filesystem::path shaToPath(const Sha& sha) const;
+    std::filesystem::path uploadPath(const Sha& sha) const;
+    void runScan(size_t threads, std::stop_token stop);
+    void dropDetails(const Sha& sha);
+    /* Reserve sha for writing, false if it is taken or already on disk */
+    bool reserve(const Sha& sha);
+    /* End the reservation of sha, publishing info or dropping the entry if it is nullptr */
+    void release(const Sha& sha, std::shared_ptr<const Info> info);
+
     std::shared_ptr<spdlog::logger> logger;
     std::filesystem::path root;
-    fp::UnorderedStringMap<std::pair<InfoState, Info>> infos;
+    std::array<Shard, 256> shards;
+    PackageIndex packages;
+
+    Duration missCacheTtl;
+    size_t uploadBufferSize;
+    bool directUploads;
+    // Caches are only memory mapped on local disks, see StoreReader
+    bool mapReads;
+    std::filesystem::path uploadDir;
+    Syncer syncer;
+
+    mutable std::mutex detailsMutex;
+    mutable fp::LruCache<std::shared_ptr<const Details>> detailsCache;
+
+    ScanProgress progress;
+    std::chrono::steady_clock::time_point scanStart;
+    std::chrono::duration<double> scanDuration{};
+    std::atomic<bool> scanned{false};
+    mutable std::mutex scanMutex;
+    mutable std::condition_variable_any scanCondition;
+    // Declared last to make sure the scan is stopped before any other member is destroyed
+    std::jthread scanner;
 };
 
+/* Reads a cache. On local disks the file is memory mapped, on network file systems a mapping
+ * faults when the file is truncated remotely, so it is read in pieces instead.
+ */
 class StoreReader {
 public:
-    StoreReader(Store& store, std::pair<InfoState, Info>& infoItem, typename Store::Token)
-        : infoItem{infoItem}
-        , stream{store.shaToPath(infoItem.second.sha), std::ios_base::in | std::ios_base::binary} {}
+    StoreReader(Store& store, std::shared_ptr<const Info> info, typename Store::Token);
+
+    /* The memory mapped file, empty if the file is read in pieces */
+    std::span<const char> data() const { return mapped ? mapped->data() : std::span<const char>{}; }
+    size_t size() const { return mapped ? mapped->size() : info->size; }
+    /* Read at offset into buffer, returns the size read */
+    size_t read(size_t offset, std::span<char> buffer);
+    const Info& getInfo() const { return *info; }
+
+private:
+    std::shared_ptr<const Info> info;
+    std::optional<fp::MappedFile> mapped;
+    std::ifstream file;
+};
+
+/* Follows a cache while it is being uploaded, reading the file as it grows */
+class StoreTail {
+public:
+    StoreTail(std::shared_ptr<Upload> upload, typename Store::Token);
+    StoreTail(const StoreTail&) = delete;
+    StoreTail& operator=(const StoreTail&) = delete;
+    ~StoreTail();
 
-    std::ifstream& getStream() { return stream; }
-    const Info& getInfo() const { return infoItem.second; }
+    std::optional<size_t> expectedSize() const { return upload->expectedSize; }
+
+    /* Read at offset into buffer, blocking until the data is written. Returns 0 once all of a
+     * committed upload has been read. Throws if the upload failed or stalled.
+     */
+    size_t read(size_t offset, std::span<char> buffer);
 
 private:
-    std::pair<InfoState, Info>& infoItem;
-    std::ifstream stream;
+    std::shared_ptr<Upload> upload;
+    std::ifstream file;
 };
 
+/* Writes a new cache. The cache becomes visible once commit succeeds, a writer that is destroyed
+ * without a successful commit removes its file and releases the sha again. Readers can follow
+ * the data written with write while the upload is running. The file is preallocated to the
+ * expected size and written in chunks of the upload buffer size of the store. The upload is
+ * written to a temporary file that commit syncs and renames to the path of the cache.
+ */
 class StoreWriter {
 public:
-    StoreWriter(Store& store, std::pair<InfoState, Info>& infoItem,
-                const std::filesystem::path& path, typename Store::Token);
+    StoreWriter(Store& store, const Sha& sha, const std::filesystem::path& path,
+                std::optional<size_t> expectedSize, typename Store::Token);
+    StoreWriter(const StoreWriter&) = delete;
+    StoreWriter& operator=(const StoreWriter&) = delete;
     ~StoreWriter();
 
-    std::ofstream& getStream() { return stream; }
+    void write(const char* data, size_t size);
+
+    /* Close the file and add the cache to the store. Throws if the file can not be written or is
+     * not a valid cache, the writer is discarded in that case.
+     */
+    std::shared_ptr<const Info> commit();
 
 private:
+    void discard() noexcept;
+
     Store& store;
-    std::pair<InfoState, Info>& infoItem;
+    Sha sha;
     std::filesystem::path path;
-    std::ofstream stream;
+    std::filesystem::path tmpPath;
+    fp::OutputFile file;
+    std::shared_ptr<Upload> upload;
+    bool done = false;
 };
 
 }  // namespace vcache
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <vcpkg-cache-server/functional.hpp>
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace vcache {
+
+constexpr std::size_t tarBlockSize = 512;
+
+/* A ustar header block of a regular file. Sizes that do not fit the octal size field use the
+ * base-256 extension understood by GNU tar, bsdtar and python.
+ */
+std::array<char, tarBlockSize> tarHeader(std::string_view name, std::uint64_t size, Time mtime);
+
+/* A tar archive of in memory files, typically memory mappings, that is never materialized. Any
+ * byte range of the archive is served as views of the headers and the file contents, so the
+ * archive can be streamed and resumed without copying the files. Files that are not in memory
+ * are read piece by piece as they are sent.
+ */
+class TarStream {
+public:
+    /* Reads the content of a file at offset into buffer, returns the size read */
+    using ReadFunction = std::function<std::size_t(std::uint64_t offset, std::span<char> buffer)>;
+
+    /* Append a file, owner keeps data alive for the lifetime of the stream */
+    void add(std::string_view name, Time mtime, std::span<const char> data,
+             std::shared_ptr<const void> owner = nullptr);
+    /* Append a file of size bytes, its content is read through read */
+    void add(std::string_view name, Time mtime, std::uint64_t size, ReadFunction read);
+
+    std::uint64_t size() const { return offsets.back() + endSize; }
+    std::size_t count() const { return entries.size(); }
+
+    /* A view of the archive starting at offset of at most length bytes. The view ends at the next
+     * header, file or padding boundary, it is empty at the end of the archive. The content of
+     * files added with a read function has no view, the chunk is empty there as well.
+     */
+    std::span<const char> chunk(std::uint64_t offset, std::size_t length) const;
+    /* Like chunk of at most buffer.size() bytes, the content of files added with a read function
+     * is read into buffer. Empty at the end of the archive or if a file could not be read.
+     */
+    std::span<const char> read(std::uint64_t offset, std::span<char> buffer) const;
+
+private:
+    static constexpr std::size_t endSize = 2 * tarBlockSize;
+
+    struct Entry {
+        std::array<char, tarBlockSize> header;
+        std::uint64_t size;
+        std::span<const char> data;
+        ReadFunction read;
+        std::shared_ptr<const void> owner;
+    };
+    std::vector<Entry> entries;
+    // Start offset of each entry followed by the offset of the end of archive blocks
+    std::vector<std::uint64_t> offsets{0};
+};
+
+struct TarEntry {
+    std::string name;
+    std::uint64_t size;
+};
+
+/* Incremental parser of a tar stream as it is received. Regular files are reported to begin,
+ * their content in pieces to data and their end to end. Other entries like directories are
+ * skipped, pax headers and GNU long names are applied to the next file. Throws on malformed
+ * headers.
+ */
+class TarParser {
+public:
+    TarParser(std::function<void(const TarEntry&)> begin,
+              std::function<void(std::span<const char>)> data, std::function<void()> end);
+
+    void feed(std::span<const char> input);
+
+    /* The end of archive was reached */
+    bool done() const { return state == State::Done; }
+    /* Not in the middle of an entry, the stream may have been closed without the end blocks */
+    bool atBoundary() const { return state == State::Header && header.empty(); }
+
+private:
+    enum class State { Header, Content, Pax, LongName, Skip, Done };
+
+    void parseHeader();
+    void finishEntry();
+
+    std::function<void(const TarEntry&)> begin;
+    std::function<void(std::span<const char>)> data;
+    std::function<void()> end;
+
+    State state = State::Header;
+    std::string header;
+    // The content of a pax or GNU long name header
+    std::string pax;
+    // Overrides of the next entry from a pax or GNU long name header
+    std::optional<std::string> paxPath;
+    std::optional<std::uint64_t> paxSize;
+    std::uint64_t size = 0;
+    std::uint64_t remaining = 0;
+    std::uint64_t padding = 0;
+};
+
+}  // namespace vcache
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vcpkg-cache-server/functional.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace vcache {
+
+struct ZipEntry {
+    std::string_view name;
+    std::uint16_t method;
+    std::uint16_t flags;
+    std::uint32_t crc;
+    std::uint64_t compressedSize;
+    std::uint64_t size;
+    std::uint64_t localOffset;
+};
+
+/* A minimal read only zip reader working on a memory mapping of the file. Only the pages of the
+ * central directory and of the entries that are read are touched, nothing is materialized up
+ * front. Without map the file is read instead, on network file systems a mapping faults if the
+ * file is truncated remotely. Then the central directory is read into memory and entries are
+ * read when they are needed. Supports stored and deflated entries and zip64 archives, throws on
+ * anything else.
+ */
+class ZipReader {
+public:
+    explicit ZipReader(const std::filesystem::path& path, bool map = true);
+    ZipReader(const ZipReader&) = delete;
+    ZipReader& operator=(const ZipReader&) = delete;
+
+    std::size_t size() const { return count; }
+
+    std::optional<ZipEntry> find(std::string_view name) const;
+    /* The first entry in central directory order matching pred */
+    std::optional<ZipEntry> findIf(const std::function<bool(std::string_view)>& pred) const;
+
+    /* Read and decompress entry, the crc is verified */
+    std::string read(const ZipEntry& entry) const;
+
+private:
+    /* The bytes of the file from offset on, at least size of them unless the file is shorter */
+    std::string_view part(std::uint64_t offset, std::uint64_t size, std::string& buffer) const;
+
+    std::optional<fp::MappedFile> mapped;
+    mutable std::ifstream file;
+    std::uint64_t fileSize = 0;
+    // The central directory up to the end of the file, if the file is not mapped
+    std::string directory;
+    // The central directory is looked up in view, the mapping or directory, at viewOffset
+    std::span<const char> view;
+    std::uint64_t viewOffset = 0;
+    std::uint64_t count = 0;
+    std::uint64_t directoryOffset = 0;
+    std::uint64_t directorySize = 0;
+};
+
+}  // namespace vcache
@@ -1,20 +1,37 @@
 #include <vcpkg-cache-server/functional.hpp>
 
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
 #include <fstream>
 #include <string>
+#include <thread>
 
 #if defined(__linux__)
 #include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <fcntl.h>
 #include <unistd.h>
 #elif defined(__APPLE__)
 #include <libproc.h>
 #include <mach/mach_init.h>
 #include <mach/task.h>
 #include <mach/vm_map.h>
+#include <sys/mount.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 #elif defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+#include <sys/mount.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <fcntl.h>
 #include <unistd.h>
 #elif defined(_WIN32)
 #define WIN32_LEAN_AND_MEAN
@@ -25,6 +42,312 @@
 
 namespace vcache::fp {
 
+#if defined(_WIN32)
+MappedFile::MappedFile(const std::filesystem::path& path) {
+    HANDLE file = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+                                nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error(fmt::format("Unable to open file {}", path.string()));
+    }
+    LARGE_INTEGER fileSize{};
+    if (!::GetFileSizeEx(file, &fileSize)) {
+        ::CloseHandle(file);
+        throw std::runtime_error(fmt::format("Unable to stat file {}", path.string()));
+    }
+    length = static_cast<size_t>(fileSize.QuadPart);
+    if (length > 0) {
+        HANDLE mapping = ::CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping) {
+            ptr = static_cast<const char*>(::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            ::CloseHandle(mapping);
+        }
+    }
+    ::CloseHandle(file);
+    if (length > 0 && !ptr) {
+        throw std::runtime_error(fmt::format("Unable to map file {}", path.string()));
+    }
+}
+MappedFile::~MappedFile() {
+    if (ptr) {
+        ::UnmapViewOfFile(ptr);
+    }
+}
+#else
+MappedFile::MappedFile(const std::filesystem::path& path) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(fmt::format("Unable to open file {}", path.string()));
+    }
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error(fmt::format("Unable to stat file {}", path.string()));
+    }
+    length = static_cast<size_t>(st.st_size);
+    if (length > 0) {
+        void* addr = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        ptr = addr == MAP_FAILED ? nullptr : static_cast<const char*>(addr);
+    }
+    ::close(fd);
+    if (length > 0 && !ptr) {
+        throw std::runtime_error(fmt::format("Unable to map file {}", path.string()));
+    }
+}
+MappedFile::~MappedFile() {
+    if (ptr) {
+        ::munmap(const_cast<char*>(ptr), length);
+    }
+}
+#endif
+
+MappedFile::MappedFile(MappedFile&& rhs) noexcept
+    : ptr{std::exchange(rhs.ptr, nullptr)}, length{std::exchange(rhs.length, 0)} {}
+
+MappedFile& MappedFile::operator=(MappedFile&& rhs) noexcept {
+    if (this != &rhs) {
+        MappedFile tmp{std::move(*this)};
+        ptr = std::exchange(rhs.ptr, nullptr);
+        length = std::exchange(rhs.length, 0);
+    }
+    return *this;
+}
+
+void prefetch(std::span<const char> data) {
+    if (data.empty()) return;
+#if defined(_WIN32)
+    WIN32_MEMORY_RANGE_ENTRY range{const_cast<char*>(data.data()), data.size()};
+    ::PrefetchVirtualMemory(::GetCurrentProcess(), 1, &range, 0);
+#else
+    // The range has to start at a page boundary
+    static const auto pageSize = static_cast<std::uintptr_t>(::sysconf(_SC_PAGESIZE));
+    const auto begin = reinterpret_cast<std::uintptr_t>(data.data());
+    const auto start = begin & ~(pageSize - 1);
+    ::posix_madvise(reinterpret_cast<void*>(start), begin - start + data.size(),
+                    POSIX_MADV_WILLNEED);
+#endif
+}
+
+void syncFile(const std::filesystem::path& path) {
+#if defined(_WIN32)
+    // NTFS journals the directory entries, only files can be flushed
+    if (std::filesystem::is_directory(path)) return;
+    HANDLE file = ::CreateFileW(path.c_str(), GENERIC_WRITE,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error(fmt::format("Unable to open file {}", path.string()));
+    }
+    const bool synced = ::FlushFileBuffers(file);
+    ::CloseHandle(file);
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error(fmt::format("Unable to open file {}", path.string()));
+    }
+    const bool synced = ::fsync(fd) == 0;
+    ::close(fd);
+#endif
+    if (!synced) {
+        throw std::runtime_error(fmt::format("Unable to sync file {}", path.string()));
+    }
+}
+
+std::vector<std::exception_ptr> syncAll(std::span<const std::filesystem::path> paths) {
+    std::vector<std::exception_ptr> errors(paths.size());
+    // The files are flushed in parallel, the disk can merge the flushes. Only the given files
+    // are flushed, not the other uploads or the database on the same file system.
+    std::atomic<size_t> next{0};
+    const auto threads =
+        std::min(paths.size(), std::max(size_t{1}, size_t{std::thread::hardware_concurrency()}));
+    std::vector<std::jthread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&]() {
+            for (auto i = next++; i < paths.size(); i = next++) {
+                try {
+                    syncFile(paths[i]);
+                } catch (...) {
+                    errors[i] = std::current_exception();
+                }
+            }
+        });
+    }
+    workers.clear();
+    return errors;
+}
+
+bool isLocalFileSystem(const std::filesystem::path& path) {
+#if defined(__linux__)
+    struct statfs fs {};
+    if (::statfs(path.c_str(), &fs) != 0) return false;
+    // The network and user space file systems that might hold a cache directory
+    switch (static_cast<std::uint32_t>(fs.f_type)) {
+        case 0x6969:      // NFS
+        case 0x517B:      // SMB
+        case 0xFE534D42:  // SMB2
+        case 0xFF534D42:  // CIFS
+        case 0x65735546:  // FUSE
+        case 0x5346414F:  // AFS
+        case 0x00C36400:  // Ceph
+        case 0x01021997:  // 9P
+            return false;
+        default:
+            return true;
+    }
+#elif defined(_WIN32)
+    const auto root = std::filesystem::absolute(path).root_path();
+    return ::GetDriveTypeW(root.c_str()) != DRIVE_REMOTE;
+#elif defined(__NetBSD__)
+    struct statvfs fs {};
+    return ::statvfs(path.c_str(), &fs) == 0 && (fs.f_flag & MNT_LOCAL) != 0;
+#else
+    struct statfs fs {};
+    return ::statfs(path.c_str(), &fs) == 0 && (fs.f_flags & MNT_LOCAL) != 0;
+#endif
+}
+
+OutputFile::OutputFile(const std::filesystem::path& aPath, std::optional<size_t> expectedSize,
+                       size_t bufferSize, bool aDirect, bool append)
+    : path{aPath}
+    , capacity{std::max(blockSize, (bufferSize + blockSize - 1) / blockSize * blockSize)}
+    , direct{aDirect && !append} {
+    buffer.reset(static_cast<char*>(::operator new[](capacity, std::align_val_t{blockSize})));
+
+#if defined(_WIN32)
+    // Unbuffered I/O on Windows needs sector aligned sizes for every write, direct is ignored
+    direct = false;
+    handle = ::CreateFileW(path.c_str(), append ? FILE_APPEND_DATA : GENERIC_WRITE,
+                           FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                           append ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        handle = nullptr;
+        throw std::runtime_error(fmt::format("Unable to open file {}", path.string()));
+    }
+    if (LARGE_INTEGER fileSize{}; append && ::GetFileSizeEx(handle, &fileSize)) {
+        inFile = static_cast<size_t>(fileSize.QuadPart);
+    }
+    if (expectedSize) {
+        FILE_ALLOCATION_INFO allocation{};
+        allocation.AllocationSize.QuadPart = static_cast<LONGLONG>(*expectedSize);
+        ::SetFileInformationByHandle(handle, FileAllocationInfo, &allocation, sizeof(allocation));
+    }
+#else
+    const int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC);
+#if defined(__linux__)
+    if (direct) {
+        fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+        // Some file systems like tmpfs do not support direct I/O
+        if (fd < 0 && errno == EINVAL) direct = false;
+    }
+#endif
+    if (fd < 0) fd = ::open(path.c_str(), flags, 0644);
+    if (fd < 0) {
+        throw std::runtime_error(fmt::format("Unable to open file {}", path.string()));
+    }
+    if (struct stat st {}; append && ::fstat(fd, &st) == 0) {
+        inFile = static_cast<size_t>(st.st_size);
+    }
+#if defined(__APPLE__)
+    if (direct) ::fcntl(fd, F_NOCACHE, 1);
+#elif !defined(__linux__)
+    direct = false;
+#endif
+    // Preallocation is only a hint, failures are ignored
+    if (expectedSize && *expectedSize > 0) {
+#if defined(__linux__)
+        // Keep the size, readers of the growing file must not see the allocated space
+        ::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(*expectedSize));
+#elif defined(__APPLE__)
+        fstore_t store{F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, static_cast<off_t>(*expectedSize), 0};
+        if (::fcntl(fd, F_PREALLOCATE, &store) == -1) {
+            store.fst_flags = F_ALLOCATEALL;
+            ::fcntl(fd, F_PREALLOCATE, &store);
+        }
+#endif
+    }
+#endif
+}
+
+OutputFile::~OutputFile() { discard(); }
+
+bool OutputFile::isOpen() const {
+#if defined(_WIN32)
+    return handle != nullptr;
+#else
+    return fd >= 0;
+#endif
+}
+
+void OutputFile::write(std::span<const char> data) {
+    while (!data.empty()) {
+        const auto length = std::min(capacity - used, data.size());
+        std::copy_n(data.data(), length, buffer.get() + used);
+        used += length;
+        data = data.subspan(length);
+        if (used == capacity) writeOut(capacity);
+    }
+}
+
+size_t OutputFile::flush() {
+    writeOut(direct ? used / blockSize * blockSize : used);
+    return inFile;
+}
+
+void OutputFile::close() {
+    if (!isOpen()) return;
+#if defined(__linux__)
+    // The last block is partial, it can only be written without direct I/O
+    if (direct && used % blockSize != 0) {
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_DIRECT);
+        direct = false;
+    }
+#endif
+    writeOut(used);
+#if defined(_WIN32)
+    const bool closed = ::CloseHandle(std::exchange(handle, nullptr));
+#else
+    const bool closed = ::close(std::exchange(fd, -1)) == 0;
+#endif
+    if (!closed) {
+        throw std::runtime_error(fmt::format("Unable to close file {}", path.string()));
+    }
+}
+
+void OutputFile::discard() noexcept {
+    used = 0;
+#if defined(_WIN32)
+    if (handle) ::CloseHandle(std::exchange(handle, nullptr));
+#else
+    if (fd >= 0) ::close(std::exchange(fd, -1));
+#endif
+}
+
+void OutputFile::writeOut(size_t length) {
+    writeAll({buffer.get(), length});
+    used -= length;
+    // Only a partial block is left after writing as many blocks as possible
+    std::copy_n(buffer.get() + length, used, buffer.get());
+}
+
+void OutputFile::writeAll(std::span<const char> data) {
+    while (!data.empty()) {
+#if defined(_WIN32)
+        DWORD count = 0;
+        const auto chunk = static_cast<DWORD>(std::min<size_t>(data.size(), 1 << 30));
+        if (!::WriteFile(handle, data.data(), chunk, &count, nullptr)) {
+            throw std::runtime_error(fmt::format("Unable to write file {}", path.string()));
+        }
+#else
+        const auto count = ::write(fd, data.data(), data.size());
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(fmt::format("Unable to write file {}", path.string()));
+        }
+#endif
+        data = data.subspan(static_cast<size_t>(count));
+        inFile += static_cast<size_t>(count);
+    }
+}
+
 std::optional<size_t> openFileDescriptors() {
 #if defined(__linux__)
     std::error_code ec;
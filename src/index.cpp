@@ -0,0 +1,191 @@
+#include <vcpkg-cache-server/index.hpp>
+#include <vcpkg-cache-server/functional.hpp>
+
+#include <fmt/format.h>
+#include <fmt/std.h>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+namespace vcache {
+
+namespace {
+
+constexpr std::array<char, 8> indexMagic{'V', 'C', 'A', 'C', 'H', 'E', 'I', 'X'};
+constexpr std::uint32_t indexVersion = 3;
+constexpr std::uint32_t indexByteOrder = 0x01020304;
+
+struct Header {
+    std::array<char, 8> magic;
+    std::uint32_t version;
+    std::uint32_t byteOrder;
+    std::uint64_t records;
+    std::uint64_t strings;
+};
+
+struct StrRef {
+    std::uint32_t offset;
+    std::uint32_t size;
+};
+
+struct Record {
+    std::array<std::uint8_t, 32> sha;
+    StrRef package;
+    StrRef version;
+    StrRef arch;
+    std::int64_t time;
+    std::uint64_t size;
+};
+
+static_assert(std::is_trivially_copyable_v<Header> && sizeof(Header) == 32);
+static_assert(std::is_trivially_copyable_v<Record> && sizeof(Record) == 72);
+
+constexpr std::uint64_t maxU32 = std::numeric_limits<std::uint32_t>::max();
+
+class StringTable {
+public:
+    StrRef add(std::string_view str) {
+        if (auto it = refs.find(str); it != refs.end()) {
+            return it->second;
+        }
+        if (data.size() + str.size() > maxU32) {
+            throw std::runtime_error("Index string table is too large");
+        }
+        const StrRef ref{static_cast<std::uint32_t>(data.size()),
+                         static_cast<std::uint32_t>(str.size())};
+        data.append(str);
+        refs.emplace(std::string{str}, ref);
+        return ref;
+    }
+
+    std::string data;
+
+private:
+    fp::UnorderedStringMap<StrRef> refs;
+};
+
+template <typename T>
+void append(std::string& out, const T& item) {
+    out.append(reinterpret_cast<const char*>(&item), sizeof(T));
+}
+
+template <typename T>
+T readAt(std::span<const char> data, size_t offset) {
+    T item;
+    std::memcpy(&item, data.data() + offset, sizeof(T));
+    return item;
+}
+
+}  // namespace
+
+std::string encodeIndex(std::span<const Info* const> infos) {
+    StringTable strings;
+    std::vector<Record> records;
+    records.reserve(infos.size());
+
+    for (const auto* info : infos) {
+        records.push_back({.sha = info->sha.bytes,
+                           .package = strings.add(info->package),
+                           .version = strings.add(info->version),
+                           .arch = strings.add(info->arch),
+                           .time = static_cast<std::int64_t>(info->time.time_since_epoch().count()),
+                           .size = info->size});
+    }
+
+    const Header header{.magic = indexMagic,
+                        .version = indexVersion,
+                        .byteOrder = indexByteOrder,
+                        .records = records.size(),
+                        .strings = strings.data.size()};
+
+    std::string out;
+    out.reserve(sizeof(Header) + records.size() * sizeof(Record) + strings.data.size());
+    append(out, header);
+    for (const auto& record : records) {
+        append(out, record);
+    }
+    out.append(strings.data);
+    return out;
+}
+
+std::vector<Info> decodeIndex(std::span<const char> data) {
+    if (data.size() < sizeof(Header)) {
+        throw std::runtime_error("Index is truncated");
+    }
+    const auto header = readAt<Header>(data, 0);
+    if (header.magic != indexMagic) {
+        throw std::runtime_error("Index has an invalid magic number");
+    }
+    if (header.version != indexVersion || header.byteOrder != indexByteOrder) {
+        throw std::runtime_error(
+            fmt::format("Index has an unsupported version {}", header.version));
+    }
+
+    const auto available = data.size() - sizeof(Header);
+    if (header.records > available / sizeof(Record) ||
+        header.records * sizeof(Record) + header.strings != available) {
+        throw std::runtime_error("Index has an invalid size");
+    }
+
+    const auto recordsOffset = sizeof(Header);
+    const auto strings = data.subspan(recordsOffset + header.records * sizeof(Record));
+
+    const auto str = [&](StrRef ref) -> std::string {
+        if (std::uint64_t{ref.offset} + ref.size > strings.size()) {
+            throw std::runtime_error("Index has an invalid string reference");
+        }
+        return std::string{strings.data() + ref.offset, ref.size};
+    };
+
+    std::vector<Info> infos;
+    infos.reserve(header.records);
+    for (std::uint64_t i = 0; i < header.records; ++i) {
+        const auto record = readAt<Record>(data, recordsOffset + i * sizeof(Record));
+        infos.push_back({.package = str(record.package),
+                         .version = str(record.version),
+                         .arch = str(record.arch),
+                         .sha = Sha{record.sha},
+                         .time = Time{Duration{static_cast<Rep>(record.time)}},
+                         .size = record.size});
+    }
+    return infos;
+}
+
+std::vector<Info> readIndex(const std::filesystem::path& file, bool map) {
+    if (map) {
+        const fp::MappedFile mapped{file};
+        return decodeIndex(mapped.data());
+    }
+    std::ifstream stream{file, std::ios_base::in | std::ios_base::binary};
+    const std::string data{std::istreambuf_iterator<char>{stream}, {}};
+    if (stream.bad() || !stream.is_open()) {
+        throw std::runtime_error(fmt::format("Unable to read index file {}", file));
+    }
+    return decodeIndex(data);
+}
+
+void writeIndex(const std::filesystem::path& file, std::string_view data) {
+    auto tmp = file;
+    tmp += ".tmp";
+    {
+        std::ofstream stream{tmp, std::ios_base::out | std::ios_base::binary};
+        stream.write(data.data(), static_cast<std::streamsize>(data.size()));
+        stream.close();
+        if (!stream.good()) {
+            throw std::runtime_error(fmt::format("Unable to write index file {}", tmp));
+        }
+    }
+    // A crash must never leave a renamed but empty index behind, and the rename itself has to
+    // reach the disk for the index to be used on the next start
+    fp::syncFile(tmp);
+    std::filesystem::rename(tmp, file);
+    fp::syncFile(std::filesystem::absolute(file).parent_path());
+}
+
+}  // namespace vcache
@@ -0,0 +1,66 @@
+#include <vcpkg-cache-server/intern.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+
+namespace vcache {
+
+std::string_view StringPool::intern(std::string_view str) {
+    auto& shard = shards[fp::StringHash{}(str) % shards.size()];
+    {
+        std::shared_lock lock{shard.mtx};
+        if (auto it = shard.strings.find(str); it != shard.strings.end()) {
+            return *it;
+        }
+    }
+    std::scoped_lock lock{shard.mtx};
+    const auto [it, inserted] = shard.strings.emplace(str);
+    if (inserted) {
+        ++count;
+        totalBytes += str.size();
+    }
+    return *it;
+}
+
+size_t StringPool::size() const { return count; }
+
+ByteSize StringPool::bytes() const { return ByteSize{totalBytes.load()}; }
+
+StringPool& StringPool::global() {
+    static StringPool pool;
+    return pool;
+}
+
+StringMap::StringMap(std::initializer_list<value_type> list, StringPool& pool) {
+    items.reserve(list.size());
+    for (const auto& [key, value] : list) {
+        items.emplace_back(pool.intern(key), pool.intern(value));
+    }
+    sortAndDeduplicate();
+}
+
+StringMap StringMap::fromViews(std::vector<value_type> items) {
+    StringMap map;
+    map.items = std::move(items);
+    map.sortAndDeduplicate();
+    return map;
+}
+
+StringMap::const_iterator StringMap::find(std::string_view key) const {
+    const auto it = std::ranges::lower_bound(items, key, std::less<>{}, &value_type::first);
+    if (it != items.end() && it->first == key) {
+        return it;
+    } else {
+        return items.end();
+    }
+}
+
+void StringMap::sortAndDeduplicate() {
+    std::ranges::stable_sort(items, std::less<>{}, &value_type::first);
+    const auto [first, last] = std::ranges::unique(items, std::equal_to<>{}, &value_type::first);
+    items.erase(first, last);
+    items.shrink_to_fit();
+}
+
+}  // namespace vcache
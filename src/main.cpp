@@ -5,6 +5,8 @@
 #include <vcpkg-cache-server/database.hpp>
 #include <vcpkg-cache-server/maintenance.hpp>
 #include <vcpkg-cache-server/logging.hpp>
+#include <vcpkg-cache-server/staging.hpp>
+#include <vcpkg-cache-server/server.hpp>
 
 #include <httplib.h>
 
@@ -17,18 +19,21 @@
 #include <spdlog/sinks/basic_file_sink.h>
 
 #include <filesystem>
-#include <fstream>
 #include <map>
 #include <unordered_map>
 #include <string>
 #include <string_view>
 #include <ranges>
+#include <span>
 #include <optional>
 #include <utility>
+#include <vector>
 #include <algorithm>
+#include <iterator>
 #include <numeric>
 #include <thread>
 #include <condition_variable>
+#include <mutex>
 #include <chrono>
 
 namespace vcache {
@@ -60,29 +65,6 @@ void logRequest(spdlog::logger& logger, spdlog::level::level_enum lvl,
         log::report(logger, lvl, "{:>20}: {}", "text length", file.content.size());
     }
 }
-httplib::Server::HandlerWithContentReader authorizeRequest(
-    const Authorization& auth, httplib::Server::HandlerWithContentReader handler) {
-    return [handler, &auth](const httplib::Request& req, httplib::Response& res,
-                            const httplib::ContentReader& content_reader) {
-        if (!req.has_header("Authorization")) {
-            res.set_header("WWW-Authenticate", "Bearer");
-            res.status = httplib::StatusCode::Unauthorized_401;
-            return;
-        }
-
-        const auto authHeader = req.get_header_value("Authorization");
-        const auto [scheme, token] = fp::parseAuthHeader(authHeader);
-
-        if (scheme != "Bearer" || !auth.write.contains(token)) {
-            res.set_header("WWW-Authenticate", "Bearer");
-            res.status = httplib::StatusCode::Forbidden_403;
-            return;
-        }
-
-        handler(req, res, content_reader);
-    };
-}
-
 std::shared_ptr<spdlog::logger> createLog(spdlog::level::level_enum logLevel,
                                           const std::optional<std::filesystem::path>& logFile) {
     auto logger = [&]() {
@@ -113,27 +95,6 @@ std::unique_ptr<httplib::Server> createServer(
     }
 }
 
-std::pair<std::string, std::string> requestUserToken(const httplib::Request& req,
-                                                     const Authorization& auth) {
-    const auto authHeader = fp::mGet(req.headers, "Authorization");
-    const auto [scheme, token] =
-        authHeader.transform(fp::parseAuthHeader)
-            .value_or(std::pair<std::string_view, std::string_view>{"-", "-"});
-
-    const auto user = mGet(auth.write, token).value_or("-");
-    return {user, std::string{token}};
-}
-
-void logCache(spdlog::logger& logger, const httplib::Request& req, const Info& info,
-              const Authorization& auth) {
-    const auto [user, token] = requestUserToken(req, auth);
-    log::info(logger,
-              "{:5} {:15} {:30} v{:<11} {:15} Size: {:10} Created: {:%Y-%m-%d %H:%M} "
-              "Sha: {} Auth {} User {}",
-              req.method, req.remote_addr, info.package, info.version, info.arch,
-              ByteSize{info.size}, info.time, info.sha, token, user);
-}
-
 }  // namespace vcache
 
 int main(int argc, char* argv[]) {
@@ -145,24 +106,39 @@ int main(int argc, char* argv[]) {
 
     auto db = db::create(settings.dbFile);
 
-    auto store = Store(settings.cacheDir, logger);
-
-    for (auto& item : store.allInfos()) {
-        auto pid = db::getOrAddPackageId(db, item.package);
-        db::getCacheId(db, item.sha).or_else([&]() -> std::optional<int> {
-            return db::addCache(db, db::Cache{.sha = item.sha,
-                                              .package = pid,
-                                              .created = item.time.time_since_epoch().count(),
-                                              .size = item.size})
-                .id;
-        });
-    }
+    auto store = Store(settings.cacheDir, settings.storage, logger);
+    // Kept in the cache root, finished uploads are moved into place without copying
+    auto staging =
+        Staging(settings.cacheDir / ".staging", settings.storage.uploadSessionTtl, logger);
 
-    std::jthread maintenance{[logger, &settings, &db, &store](std::stop_token token) {
+    // Serializes the writes to the db, maintenance runs in a transaction of its own
+    std::mutex dbMutex;
+
+    std::jthread maintenance{[logger, &settings, &db, &dbMutex, &store,
+                              &staging](std::stop_token token) {
         try {
+            if (!store.waitForScan(token)) return;
+
+            {
+                std::scoped_lock lock{dbMutex};
+                for (auto& item : store.allInfos()) {
+                    getOrAddCacheId(db, item);
+                }
+            }
+
             std::mutex mutex;
             while (!token.stop_requested()) {
-                vcache::maintain(store, db, settings.maintenance, logger, Clock::now());
+                {
+                    std::scoped_lock lock{dbMutex};
+                    vcache::maintain(store, db, settings.maintenance, logger, Clock::now());
+                }
+                try {
+                    store.saveIndex();
+                } catch (const std::exception& e) {
+                    log::warn(*logger, "[Maintain] unable to save index {}", e.what());
+                }
+                // Sessions are otherwise only pruned when a new one is created
+                staging.prune();
                 std::unique_lock lock(mutex);
                 std::condition_variable_any().wait_for(lock, token, std::chrono::hours{1},
                                                        [] { return false; });
@@ -175,6 +151,8 @@ int main(int argc, char* argv[]) {
     }};
 
     auto server = createServer(settings.certAndKey);
+    const auto service = CacheService{
+        .store = store, .db = db, .dbMutex = dbMutex, .auth = settings.auth, .logger = logger};
 
     if (settings.threadPool.baseThreads || settings.threadPool.maxThreads ||
         settings.threadPool.maxQueuedRequests) {
@@ -216,72 +194,48 @@ int main(int argc, char* argv[]) {
                 res.status = httplib::StatusCode::InternalServerError_500;
             });
 
-    server->Get(
-        R"(/cache/([0-9a-f]{64}))", [&](const httplib::Request& req, httplib::Response& res) {
-            const auto sha = req.matches[1].str();
-
-            if (auto reader = store.read(sha)) {
-                const auto& info = reader->getInfo();
-                logCache(*logger, req, info, settings.auth);
-
-                const auto cid = *db::getCacheId(db, info.sha);
-                const auto now = Clock::now();
-                db::addDownload(
-                    db, db::Download{.cache = cid,
-                                     .ip = fp::mGet(req.headers, "REMOTE_ADDR").value_or("?.?.?.?"),
-                                     .user = requestUserToken(req, settings.auth).first,
-                                     .time = now.time_since_epoch().count()});
-                db::updateLastUse(db, cid, now);
-
-                res.set_content_provider(
-                    info.size, "application/zip",
-                    [reader, buff = std::vector<char>(1024)](
-                        size_t offset, size_t length, httplib::DataSink& sink) mutable -> bool {
-                        buff.resize(length);
-                        reader->getStream().seekg(offset);
-                        reader->getStream().read(buff.data(), length);
-                        sink.write(buff.data(), length);
-                        return true;
-                    });
-
-            } else {
-                res.status = httplib::StatusCode::NotFound_404;
-                return;
-            }
-        });
+    setExpectContinueHandler(*server, service);
+    addDownloadRoute(*server, service);
 
     server->Put(
         "/cache/([0-9a-f]{64})",
         authorizeRequest(settings.auth, [&](const httplib::Request& req, httplib::Response& res,
                                             const httplib::ContentReader& content_reader) {
-            const auto sha = req.matches[1].str();
-
-            if (auto writer = store.write(sha)) {
-                content_reader([writer](const char* data, size_t data_length) {
-                    writer->getStream().write(data, data_length);
-                    return true;
-                });
-            } else {
+            const auto sha = *Sha::parse(req.matches[1].str());
+
+            const auto writer = store.write(
+                sha, fp::mGet(req.headers, "Content-Length").and_then(fp::strToNum<size_t>));
+            if (!writer) {
                 res.status = httplib::StatusCode::Conflict_409;
                 return;
             }
+            // An incomplete upload is discarded with the writer
+            const auto received = content_reader([&](const char* data, size_t data_length) {
+                writer->write(data, data_length);
+                return true;
+            });
+            if (!received) return;
 
-            if (const auto* info = store.info(sha)) {
+            try {
+                const auto info = writer->commit();
                 logCache(*logger, req, *info, settings.auth);
-
-                db::addCache(
-                    db, db::Cache{.sha = info->sha,
-                                  .package = db::getOrAddPackageId(db, info->package),
-                                  .created = info->time.time_since_epoch().count(),
-                                  .ip = fp::mGet(req.headers, "REMOTE_ADDR").value_or("?.?.?.?"),
-                                  .user = requestUserToken(req, settings.auth).first,
-                                  .size = info->size});
-
-            } else {
-                log::warn(*logger, "Expected to find a new package at {}", sha);
+                std::scoped_lock lock{dbMutex};
+                recordUpload(db, req, *info, settings.auth);
+            } catch (const std::exception& e) {
+                log::warn(*logger, "Rejected upload of {}: {}", sha, e.what());
+                res.status = httplib::StatusCode::BadRequest_400;
+                res.set_content(e.what(), "text/plain");
             }
         }));
 
+    addBatchRoute(*server, service);
+
+    addUploadRoutes(*server, service, staging);
+
+    addExistsRoute(*server, service);
+
+    addBundleRoute(*server, service);
+
     const auto mode = [](const httplib::Request& req) -> site::Mode {
         return fp::mGet(req.params, "mode")
             .and_then(enumTo<site::Mode>{})
@@ -321,11 +275,11 @@ int main(int argc, char* argv[]) {
     };
 
     server->Get("/status", [&](const httplib::Request& req, httplib::Response& res) {
-        res.set_content(site::status(mode(req)), "text/html");
+        res.set_content(site::status(store, mode(req)), "text/html");
     });
 
-    server->Get("/status/data", [](const httplib::Request&, httplib::Response& res) {
-        res.set_content(site::statusData(), "text/html");
+    server->Get("/status/data", [&](const httplib::Request&, httplib::Response& res) {
+        res.set_content(site::statusData(store), "text/html");
     });
 
     server->Get("/match", [](const httplib::Request&, httplib::Response& res) {
@@ -145,7 +145,11 @@ void maintain(Store& store, db::Database& db, const Maintenance& maintenance,
     } else {
         db.commit();
         for (const auto& sha : toDelete) {
-            store.remove(sha);
+            if (const auto key = Sha::parse(sha)) {
+                store.remove(*key);
+            } else {
+                log::warn(*logger, "[Maintain] Invalid sha {} in database", sha);
+            }
         }
     }
     log::info(*logger, "[Maintain] Maintenance finished");
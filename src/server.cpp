@@ -0,0 +1,716 @@
+#include <vcpkg-cache-server/server.hpp>
+#include <vcpkg-cache-server/functional.hpp>
+#include <vcpkg-cache-server/logging.hpp>
+#include <vcpkg-cache-server/tar.hpp>
+
+#include <fmt/format.h>
+#include <fmt/std.h>
+#include <fmt/chrono.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <semaphore>
+#include <span>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace vcache {
+
+/* Check the write authorization of req, returns 200 or the status of the rejection */
+int authorize(const Authorization& auth, const httplib::Request& req, httplib::Response& res) {
+    if (!req.has_header("Authorization")) {
+        res.set_header("WWW-Authenticate", "Bearer");
+        return httplib::StatusCode::Unauthorized_401;
+    }
+
+    const auto authHeader = req.get_header_value("Authorization");
+    const auto [scheme, token] = fp::parseAuthHeader(authHeader);
+
+    if (scheme != "Bearer" || !auth.write.contains(token)) {
+        res.set_header("WWW-Authenticate", "Bearer");
+        return httplib::StatusCode::Forbidden_403;
+    }
+    return httplib::StatusCode::OK_200;
+}
+
+httplib::Server::HandlerWithContentReader authorizeRequest(
+    const Authorization& auth, httplib::Server::HandlerWithContentReader handler) {
+    return [handler, &auth](const httplib::Request& req, httplib::Response& res,
+                            const httplib::ContentReader& content_reader) {
+        if (const auto status = authorize(auth, req, res); status != httplib::StatusCode::OK_200) {
+            res.status = status;
+            return;
+        }
+
+        handler(req, res, content_reader);
+    };
+}
+
+std::pair<std::string, std::string> requestUserToken(const httplib::Request& req,
+                                                     const Authorization& auth) {
+    const auto authHeader = fp::mGet(req.headers, "Authorization");
+    const auto [scheme, token] =
+        authHeader.transform(fp::parseAuthHeader)
+            .value_or(std::pair<std::string_view, std::string_view>{"-", "-"});
+
+    const auto user = mGet(auth.write, token).value_or("-");
+    return {user, std::string{token}};
+}
+
+int getOrAddCacheId(db::Database& db, const Info& info) {
+    return *db::getCacheId(db, info.sha.str()).or_else([&]() -> std::optional<int> {
+        return db::addCache(db, db::Cache{.sha = info.sha.str(),
+                                          .package = db::getOrAddPackageId(db, info.package),
+                                          .created = info.time.time_since_epoch().count(),
+                                          .size = info.size})
+            .id;
+    });
+}
+
+void recordDownload(db::Database& db, const httplib::Request& req, const Info& info,
+                    const Authorization& auth) {
+    // Caches found by a running scan might not have been added to the db yet
+    const auto cid = getOrAddCacheId(db, info);
+    const auto now = Clock::now();
+    db::addDownload(db,
+                    db::Download{.cache = cid,
+                                 .ip = fp::mGet(req.headers, "REMOTE_ADDR").value_or("?.?.?.?"),
+                                 .user = requestUserToken(req, auth).first,
+                                 .time = now.time_since_epoch().count()});
+    db::updateLastUse(db, cid, now);
+}
+
+void recordUpload(db::Database& db, const httplib::Request& req, const Info& info,
+                  const Authorization& auth) {
+    db::addCache(db, db::Cache{.sha = info.sha.str(),
+                               .package = db::getOrAddPackageId(db, info.package),
+                               .created = info.time.time_since_epoch().count(),
+                               .ip = fp::mGet(req.headers, "REMOTE_ADDR").value_or("?.?.?.?"),
+                               .user = requestUserToken(req, auth).first,
+                               .size = info.size});
+}
+
+namespace {
+
+/* How the body of a cache is sent */
+enum class CacheBody {
+    None,    // The response is complete, the client has the cache or a precondition failed
+    Ranges,  // The ranges of the request, or the whole cache if there are none
+    Full,    // The whole cache, the ranges of the request are to be ignored
+};
+
+/* Set the validators and descriptive headers of a cache. The sha alone is not a validator, a
+ * cache removed by the maintenance can be uploaded again with other content, so the size and
+ * the modification time of the file are part of the entity tag. Caches are revalidated for the
+ * same reason.
+ */
+CacheBody setCacheHeaders(const httplib::Request& req, httplib::Response& res, const Info& info) {
+    const auto etag =
+        fmt::format("\"{}-{:x}-{:x}\"", info.sha, info.size,
+                    static_cast<std::uint64_t>(info.time.time_since_epoch().count()));
+    res.set_header("ETag", etag);
+    res.set_header("Cache-Control", "public, no-cache");
+    res.set_header("Accept-Ranges", "bytes");
+    res.set_header("X-Vcpkg-Package", info.package);
+    res.set_header("X-Vcpkg-Version", info.version);
+    res.set_header("X-Vcpkg-Arch", info.arch);
+
+    if (req.has_header("If-None-Match") &&
+        fp::matchesETag(req.get_header_value("If-None-Match"), etag)) {
+        res.status = httplib::StatusCode::NotModified_304;
+        return CacheBody::None;
+    }
+    // Without a matching validator the whole cache is sent. Only entity tags are handed out, an
+    // If-Range date never matches.
+    if (req.has_header("If-Range") && !req.ranges.empty() &&
+        !fp::matchesETag(req.get_header_value("If-Range"), etag, false)) {
+        // httplib writes a multipart body for several ranges whatever the status, there is no
+        // way to send the whole cache in its place. vcpkg and curl only ever ask for one range.
+        if (req.ranges.size() > 1) {
+            res.status = httplib::StatusCode::PreconditionFailed_412;
+            return CacheBody::None;
+        }
+        res.status = httplib::StatusCode::OK_200;
+        return CacheBody::Full;
+    }
+    return CacheBody::Ranges;
+}
+
+}  // namespace
+
+void logCache(spdlog::logger& logger, const httplib::Request& req, const Info& info,
+              const Authorization& auth) {
+    const auto [user, token] = requestUserToken(req, auth);
+    log::info(logger,
+              "{:5} {:15} {:30} v{:<11} {:15} Size: {:10} Created: {:%Y-%m-%d %H:%M} "
+              "Sha: {} Auth {} User {}",
+              req.method, req.remote_addr, info.package, info.version, info.arch,
+              ByteSize{info.size}, info.time, info.sha, token, user);
+}
+
+int expectContinue(const CacheService& service, const httplib::Request& req,
+                   httplib::Response& res) {
+    // Uploads are rejected before the client sends the body, deciding only on the authorization
+    // and the index
+    constexpr std::string_view prefix = "/cache/";
+    const bool upload = (req.method == "PUT" && req.path.starts_with(prefix)) ||
+                        (req.method == "POST" && req.path == "/cache/batch") ||
+                        (req.method == "PATCH" && req.path.starts_with("/upload/"));
+    if (!upload) return httplib::StatusCode::Continue_100;
+
+    if (const auto status = authorize(service.auth, req, res);
+        status != httplib::StatusCode::OK_200) {
+        res.status = status;
+        return status;
+    }
+    if (req.method == "PUT") {
+        const auto sha = Sha::parse(std::string_view{req.path}.substr(prefix.size()));
+        if (sha && service.store.known(*sha)) {
+            res.status = httplib::StatusCode::Conflict_409;
+            return res.status;
+        }
+    }
+    return httplib::StatusCode::Continue_100;
+}
+
+void setExpectContinueHandler(httplib::Server& server, const CacheService& service) {
+    server.set_expect_100_continue_handler(
+        [service](const httplib::Request& req, httplib::Response& res) {
+            return expectContinue(service, req, res);
+        });
+}
+
+void addDownloadRoute(httplib::Server& server, const CacheService& service) {
+    server.Get(
+        R"(/cache/([0-9a-f]{64}))", [service](const httplib::Request& req, httplib::Response& res) {
+            // The route only matches valid shas
+            const auto sha = *Sha::parse(req.matches[1].str());
+
+            // httplib routes HEAD here as well. Existence checks are answered from the index
+            // alone, no file is opened and no download is recorded. While the initial scan is
+            // running caches it has not reached yet are still looked up on disk.
+            if (req.method == "HEAD") {
+                auto& store = service.store;
+                const auto lookup = [&]() {
+                    return store.scanStatus().done ? std::as_const(store).info(sha)
+                                                   : store.info(sha);
+                };
+                auto info = lookup();
+                const auto tail = info ? nullptr : store.tail(sha);
+                // The upload might have been committed in between
+                if (!info && !tail) info = lookup();
+
+                if (info) {
+                    if (setCacheHeaders(req, res, *info) == CacheBody::None) return;
+                    // Only sets the content length, the provider is never called for HEAD
+                    res.set_content_provider(
+                        info->size, "application/zip",
+                        [](size_t, size_t, httplib::DataSink&) { return false; });
+                } else if (tail) {
+                    // A GET would follow the upload, announce what it would send
+                    if (const auto size = tail->expectedSize()) {
+                        res.set_content_provider(
+                            *size, "application/zip",
+                            [](size_t, size_t, httplib::DataSink&) { return false; });
+                    } else {
+                        res.set_chunked_content_provider(
+                            "application/zip", [](size_t, httplib::DataSink&) { return false; });
+                    }
+                } else {
+                    res.status = httplib::StatusCode::NotFound_404;
+                }
+                return;
+            }
+
+            auto reader = service.store.read(sha);
+            auto tail = reader ? nullptr : service.store.tail(sha);
+            // The upload might have been committed in between
+            if (!reader && !tail) reader = service.store.read(sha);
+
+            if (reader) {
+                const auto& info = reader->getInfo();
+
+                const auto body = setCacheHeaders(req, res, info);
+                if (body == CacheBody::None) return;
+
+                logCache(*service.logger, req, info, service.auth);
+                {
+                    std::scoped_lock lock{service.dbMutex};
+                    recordDownload(service.db, req, info, service.auth);
+                }
+
+                // Write straight from the mapped file, the socket write is the only copy made.
+                // Files that are not mapped are read through a buffer small enough to stay in the
+                // CPU caches. Large files are written in chunks to let httplib check for
+                // disconnects.
+                static constexpr size_t chunk = 4 * 1024 * 1024;
+                static constexpr size_t bufferSize = 1024 * 1024;
+                auto buffer = reader->data().empty()
+                                  ? std::make_shared<std::vector<char>>(bufferSize)
+                                  : nullptr;
+                // The size written, 0 if the write failed
+                const auto send = [reader, buffer](size_t offset, size_t length,
+                                                   httplib::DataSink& sink) -> size_t {
+                    if (const auto data = reader->data(); !data.empty()) {
+                        const auto size = std::min(length, chunk);
+                        return sink.write(data.data() + offset, size) ? size : 0;
+                    }
+                    const auto size = std::min(length, bufferSize);
+                    const auto n = reader->read(offset, std::span{*buffer}.first(size));
+                    return n > 0 && sink.write(buffer->data(), n) ? n : 0;
+                };
+                const auto full = body == CacheBody::Full;
+                res.set_content_provider(
+                    reader->size(), "application/zip",
+                    [send, full, size = reader->size()](size_t offset, size_t length,
+                                                        httplib::DataSink& sink) {
+                        if (full) {
+                            // httplib still asks for the range of the request, writing the whole
+                            // cache in the first call moves past its end and completes the body
+                            for (size_t pos = 0; pos < size;) {
+                                const auto n = send(pos, size - pos, sink);
+                                if (n == 0) return false;
+                                pos += n;
+                            }
+                            return true;
+                        }
+                        return send(offset, length, sink) > 0;
+                    });
+
+            } else if (tail) {
+                // The cache is being uploaded, follow the upload instead of letting the client
+                // build it again. A failed upload aborts the response.
+                log::info(*service.logger, "{:5} {:15} Following upload of {}", req.method,
+                          req.remote_addr, sha);
+                constexpr size_t bufferSize = 1024 * 1024;
+                auto buffer = std::make_shared<std::vector<char>>(bufferSize);
+                // The size read into the buffer, 0 at the end and nullopt if the upload failed
+                const auto read = [tail, buffer, logger = service.logger](
+                                      size_t offset, size_t length) -> std::optional<size_t> {
+                    try {
+                        const auto size = std::min(length, buffer->size());
+                        return tail->read(offset, std::span{*buffer}.first(size));
+                    } catch (const std::exception& e) {
+                        log::warn(*logger, "Stopped following upload: {}", e.what());
+                        return std::nullopt;
+                    }
+                };
+                if (const auto size = tail->expectedSize()) {
+                    res.set_content_provider(
+                        *size, "application/zip",
+                        [read, buffer](size_t offset, size_t length, httplib::DataSink& sink) {
+                            const auto n = read(offset, length);
+                            return n && *n > 0 && sink.write(buffer->data(), *n);
+                        });
+                } else {
+                    res.set_chunked_content_provider(
+                        "application/zip", [read, buffer](size_t offset, httplib::DataSink& sink) {
+                            const auto n = read(offset, bufferSize);
+                            if (!n) return false;
+                            if (*n == 0) {
+                                sink.done();
+                                return true;
+                            }
+                            return sink.write(buffer->data(), *n);
+                        });
+                }
+
+            } else {
+                res.status = httplib::StatusCode::NotFound_404;
+                return;
+            }
+        });
+}
+
+void addUploadRoutes(httplib::Server& server, const CacheService& service, Staging& staging) {
+    // Resumable uploads of large caches. POST /upload/<sha> creates a session and answers its
+    // id. PATCH /upload/<id> appends a chunk at the offset given in the Upload-Offset header,
+    // GET /upload/<id> reports the offset to continue at after a dropped connection.
+    // POST /upload/<id>/finalize adds the cache to the store, validated like a PUT, and
+    // DELETE /upload/<id> abandons the upload.
+    server.Post(
+        "/upload/([0-9a-f]{64})",
+        authorizeRequest(service.auth, [service, &staging](
+                                           const httplib::Request& req, httplib::Response& res,
+                                           const httplib::ContentReader&) {
+            const auto sha = *Sha::parse(req.matches[1].str());
+            if (service.store.known(sha) || service.store.info(sha)) {
+                res.status = httplib::StatusCode::Conflict_409;
+                return;
+            }
+            const auto session = staging.create(sha);
+            log::info(*service.logger, "{:5} {:15} Started upload session {} of {}", req.method,
+                      req.remote_addr, session->id, sha);
+            res.status = httplib::StatusCode::Created_201;
+            res.set_header("Location", fmt::format("/upload/{}", session->id));
+            res.set_header("Upload-Offset", "0");
+            res.set_content(session->id, "text/plain");
+        }));
+
+    server.Get("/upload/([0-9a-f]{32})", [service, &staging](const httplib::Request& req,
+                                                               httplib::Response& res) {
+        if (const auto status = authorize(service.auth, req, res);
+            status != httplib::StatusCode::OK_200) {
+            res.status = status;
+            return;
+        }
+        const auto session = staging.find(req.matches[1].str());
+        std::error_code ec;
+        const auto size = session ? std::filesystem::file_size(session->path, ec) : 0;
+        if (!session || ec) {
+            res.status = httplib::StatusCode::NotFound_404;
+            return;
+        }
+        res.set_header("Upload-Offset", std::to_string(size));
+        res.set_content(std::to_string(size), "text/plain");
+    });
+
+    server.Patch(
+        "/upload/([0-9a-f]{32})",
+        authorizeRequest(service.auth, [service, &staging](
+                                           const httplib::Request& req, httplib::Response& res,
+                                           const httplib::ContentReader& content_reader) {
+            const auto session = staging.find(req.matches[1].str());
+            if (!session) {
+                res.status = httplib::StatusCode::NotFound_404;
+                return;
+            }
+            // Only one chunk of a session is received at a time
+            std::unique_lock lock{session->mtx, std::try_to_lock};
+            if (!lock) {
+                res.status = httplib::StatusCode::Conflict_409;
+                return;
+            }
+            std::error_code ec;
+            const auto size = std::filesystem::file_size(session->path, ec);
+            if (session->closed || ec) {
+                res.status = httplib::StatusCode::NotFound_404;
+                return;
+            }
+            const auto offset =
+                fp::mGet(req.headers, "Upload-Offset").and_then(fp::strToNum<size_t>);
+            if (!offset) {
+                res.status = httplib::StatusCode::BadRequest_400;
+                return;
+            }
+            if (*offset != size) {
+                res.set_header("Upload-Offset", std::to_string(size));
+                res.status = httplib::StatusCode::Conflict_409;
+                return;
+            }
+
+            // Everything that arrives is kept, after a dropped connection the client continues
+            // at the new offset. The chunk is synced like an upload before it is confirmed.
+            std::string error;
+            try {
+                fp::OutputFile file{session->path, std::nullopt, service.store.bufferSize(),
+                                    false, true};
+                content_reader([&](const char* data, size_t data_length) {
+                    try {
+                        file.write({data, data_length});
+                        return true;
+                    } catch (const std::exception& e) {
+                        error = e.what();
+                        return false;
+                    }
+                });
+                file.close();
+                service.store.sync(session->path);
+            } catch (const std::exception& e) {
+                error = e.what();
+            }
+            if (!error.empty()) {
+                log::warn(*service.logger, "Unable to write upload session {}: {}", session->id,
+                          error);
+            }
+            res.set_header("Upload-Offset",
+                           std::to_string(std::filesystem::file_size(session->path, ec)));
+            res.status = error.empty() && !ec ? httplib::StatusCode::NoContent_204
+                                              : httplib::StatusCode::InternalServerError_500;
+        }));
+
+    server.Post(
+        "/upload/([0-9a-f]{32})/finalize",
+        authorizeRequest(service.auth, [service, &staging](
+                                           const httplib::Request& req, httplib::Response& res,
+                                           const httplib::ContentReader&) {
+            const auto session = staging.find(req.matches[1].str());
+            if (!session) {
+                res.status = httplib::StatusCode::NotFound_404;
+                return;
+            }
+            std::scoped_lock lock{session->mtx};
+            if (session->closed) {
+                res.status = httplib::StatusCode::NotFound_404;
+                return;
+            }
+
+            try {
+                const auto info = service.store.commit(session->sha, session->path);
+                staging.remove(*session);
+                if (!info) {
+                    res.status = httplib::StatusCode::Conflict_409;
+                    return;
+                }
+                logCache(*service.logger, req, *info, service.auth);
+                std::scoped_lock dbLock{service.dbMutex};
+                recordUpload(service.db, req, *info, service.auth);
+                res.status = httplib::StatusCode::Created_201;
+            } catch (const std::exception& e) {
+                staging.remove(*session);
+                log::warn(*service.logger, "Rejected upload of {}: {}", session->sha, e.what());
+                res.status = httplib::StatusCode::BadRequest_400;
+                res.set_content(e.what(), "text/plain");
+            }
+        }));
+
+    server.Delete("/upload/([0-9a-f]{32})", [service, &staging](const httplib::Request& req,
+                                                                  httplib::Response& res) {
+        if (const auto status = authorize(service.auth, req, res);
+            status != httplib::StatusCode::OK_200) {
+            res.status = status;
+            return;
+        }
+        const auto session = staging.find(req.matches[1].str());
+        if (!session) {
+            res.status = httplib::StatusCode::NotFound_404;
+            return;
+        }
+        std::scoped_lock lock{session->mtx};
+        staging.remove(*session);
+        res.status = httplib::StatusCode::NoContent_204;
+    });
+}
+
+void addExistsRoute(httplib::Server& server, const CacheService& service) {
+    // Batch existence check for install plans, the body is a list of shas separated by white
+    // space or commas. Answered from the index in one pass, like HEAD, with one "<sha> <size>"
+    // line per existing cache in request order.
+    server.Post("/cache/exists", [service](const httplib::Request& req, httplib::Response& res) {
+        const auto shas = parseShas(req.body);
+        if (!shas) {
+            res.status = httplib::StatusCode::BadRequest_400;
+            res.set_content("Invalid sha in request", "text/plain");
+            return;
+        }
+
+        auto& store = service.store;
+        auto infos = store.infos(*shas);
+        if (!store.scanStatus().done) {
+            for (size_t i = 0; i < infos.size(); ++i) {
+                if (!infos[i]) infos[i] = store.info((*shas)[i]);
+            }
+        }
+
+        std::string content;
+        content.reserve(infos.size() * 80);
+        for (const auto& info : infos) {
+            if (info) fmt::format_to(std::back_inserter(content), "{} {}\n", info->sha, info->size);
+        }
+        res.set_content(std::move(content), "text/plain");
+    });
+}
+
+void addBundleRoute(httplib::Server& server, const CacheService& service) {
+    // Download many caches in a single tar stream, the body is a list of shas like for
+    // /cache/exists. Caches that do not exist are left out, every cache is named <sha>.zip.
+    server.Post("/cache/bundle", [service](const httplib::Request& req, httplib::Response& res) {
+        const auto shas = parseShas(req.body);
+        if (!shas) {
+            res.status = httplib::StatusCode::BadRequest_400;
+            res.set_content("Invalid sha in request", "text/plain");
+            return;
+        }
+
+        auto bundle = std::make_shared<TarStream>();
+        ShaMap<bool> added;
+        std::vector<const Info*> sent;
+        bool unmapped = false;
+        for (const auto& sha : *shas) {
+            if (!added.try_emplace(sha, true).second) continue;
+            if (auto reader = service.store.read(sha)) {
+                const auto& info = reader->getInfo();
+                logCache(*service.logger, req, info, service.auth);
+                sent.push_back(&info);
+                if (const auto data = reader->data(); !data.empty()) {
+                    bundle->add(fmt::format("{}.zip", sha), info.time, data, reader);
+                } else {
+                    // Caches on network file systems are not mapped, they are read piecewise
+                    bundle->add(fmt::format("{}.zip", sha), info.time, reader->size(),
+                                [reader](std::uint64_t offset, std::span<char> buffer) {
+                                    return reader->read(offset, buffer);
+                                });
+                    unmapped = true;
+                }
+            }
+        }
+
+        // The downloads of the whole bundle are added to the db in a single transaction, the
+        // readers in the bundle keep their infos alive
+        try {
+            std::scoped_lock lock{service.dbMutex};
+            service.db.transaction([&]() {
+                for (const auto* info : sent) {
+                    recordDownload(service.db, req, *info, service.auth);
+                }
+                return true;
+            });
+        } catch (const std::exception& e) {
+            log::error(*service.logger, "Unable to record bundle download: {}", e.what());
+        }
+
+        // The pages of the caches are requested ahead of the socket writes, so reading the next
+        // caches from disk overlaps with sending the current one. Caches that are not mapped are
+        // read through a buffer small enough to stay in the CPU caches, like downloads.
+        auto ahead = std::make_shared<std::uint64_t>(0);
+        static constexpr size_t bufferSize = 1024 * 1024;
+        auto buffer = unmapped ? std::make_shared<std::vector<char>>(bufferSize) : nullptr;
+        res.set_content_provider(
+            bundle->size(), "application/x-tar",
+            [bundle, ahead, buffer](size_t offset, size_t length, httplib::DataSink& sink) {
+                constexpr size_t chunk = 4 * 1024 * 1024;
+                constexpr std::uint64_t readAhead = 64 * 1024 * 1024;
+                const auto end = std::min<std::uint64_t>(offset + readAhead, bundle->size());
+                for (*ahead = std::max<std::uint64_t>(*ahead, offset); *ahead < end;) {
+                    const auto part = bundle->chunk(*ahead, end - *ahead);
+                    if (part.empty()) break;
+                    fp::prefetch(part);
+                    *ahead += part.size();
+                }
+                auto part = bundle->chunk(offset, std::min(length, chunk));
+                if (part.empty() && buffer) {
+                    const auto size = std::min(length, bufferSize);
+                    part = bundle->read(offset, std::span{*buffer}.first(size));
+                }
+                return !part.empty() && sink.write(part.data(), part.size());
+            });
+    });
+}
+
+void addBatchRoute(httplib::Server& server, const CacheService& service) {
+    // Commits of all batches that may run at once, each one reads and syncs a whole cache
+    const auto slots = std::make_shared<std::counting_semaphore<>>(
+        std::max(std::ptrdiff_t{1},
+                 static_cast<std::ptrdiff_t>(std::thread::hardware_concurrency())));
+
+    // Upload many caches in one request as a tar stream of <sha>.zip files. Each cache is
+    // committed in the background while the next one is received, the response has one
+    // "<name> <status>" line per file. Receiving waits for a free slot before the next commit.
+    server.Post(
+        "/cache/batch",
+        authorizeRequest(service.auth, [service, slots](
+                                           const httplib::Request& req, httplib::Response& res,
+                                           const httplib::ContentReader& content_reader) {
+            struct Upload {
+                std::string name;
+                int status = 0;
+                std::future<std::shared_ptr<const Info>> commit;
+            };
+            std::vector<Upload> uploads;
+            std::shared_ptr<StoreWriter> writer;
+
+            TarParser parser{
+                [&](const TarEntry& entry) {
+                    auto& upload = uploads.emplace_back(Upload{.name = entry.name});
+                    const auto file = std::filesystem::path{entry.name}.filename();
+                    const auto sha = file.extension() == ".zip" ? Sha::parse(file.stem().string())
+                                                                : std::nullopt;
+                    if (!sha) {
+                        upload.status = httplib::StatusCode::BadRequest_400;
+                    } else if (writer = service.store.write(*sha, entry.size); !writer) {
+                        upload.status = httplib::StatusCode::Conflict_409;
+                    }
+                },
+                [&](std::span<const char> data) {
+                    if (writer) writer->write(data.data(), data.size());
+                },
+                [&]() {
+                    if (!writer) return;
+                    slots->acquire();
+                    auto commit = [item = std::move(writer), slots]() {
+                        try {
+                            auto info = item->commit();
+                            slots->release();
+                            return info;
+                        } catch (...) {
+                            slots->release();
+                            throw;
+                        }
+                    };
+                    uploads.back().commit = std::async(std::launch::async, std::move(commit));
+                }};
+
+            std::string error;
+            content_reader([&](const char* data, size_t data_length) {
+                try {
+                    parser.feed({data, data_length});
+                    return true;
+                } catch (const std::exception& e) {
+                    error = e.what();
+                    return false;
+                }
+            });
+            if (writer) {
+                // The stream ended in the middle of a file, it is discarded with the writer
+                uploads.back().status = httplib::StatusCode::BadRequest_400;
+                writer.reset();
+            }
+            if (error.empty() && !parser.done() && !parser.atBoundary()) {
+                error = "Incomplete tar stream";
+            }
+
+            std::string content;
+            std::vector<std::shared_ptr<const Info>> created;
+            for (auto& upload : uploads) {
+                if (upload.commit.valid()) {
+                    try {
+                        created.push_back(upload.commit.get());
+                        upload.status = httplib::StatusCode::Created_201;
+                    } catch (const std::exception& e) {
+                        log::warn(*service.logger, "Rejected upload of {}: {}", upload.name,
+                                  e.what());
+                        upload.status = httplib::StatusCode::BadRequest_400;
+                    }
+                } else if (upload.status == 0) {
+                    upload.status = httplib::StatusCode::InternalServerError_500;
+                }
+                fmt::format_to(std::back_inserter(content), "{} {} {}\n", upload.name,
+                               upload.status, httplib::status_message(upload.status));
+            }
+
+            // The caches of the whole batch are added to the db in a single transaction. They
+            // are committed to the store either way, a failure to record them does not change
+            // the status of the uploads.
+            for (const auto& info : created) {
+                logCache(*service.logger, req, *info, service.auth);
+            }
+            try {
+                std::scoped_lock lock{service.dbMutex};
+                service.db.transaction([&]() {
+                    for (const auto& info : created) {
+                        recordUpload(service.db, req, *info, service.auth);
+                    }
+                    return true;
+                });
+            } catch (const std::exception& e) {
+                log::error(*service.logger, "Unable to record batch upload: {}", e.what());
+            }
+
+            if (!error.empty()) {
+                log::warn(*service.logger, "Invalid batch upload: {}", error);
+                fmt::format_to(std::back_inserter(content), "{}\n", error);
+                res.status = httplib::StatusCode::BadRequest_400;
+            }
+            res.set_content(std::move(content), "text/plain");
+        }));
+}
+
+}  // namespace vcache
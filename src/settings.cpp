@@ -38,19 +38,22 @@ std::string formatDurationForYaml(Duration dur) {
     const auto minutes = duration_cast<c::minutes>(dur);
     dur -= minutes;
     const auto seconds = duration_cast<c::seconds>(dur);
+    dur -= seconds;
+    const auto milliseconds = duration_cast<c::milliseconds>(dur);
 
     std::string res;
-    const auto append = [&](auto count, char unit) {
+    const auto append = [&](auto count, std::string_view unit) {
         if (count != 0) {
             if (!res.empty()) res += ' ';
             res += fmt::format("{}{}", count, unit);
         }
     };
-    append(years.count(), 'y');
-    append(days.count(), 'd');
-    append(hours.count(), 'h');
-    append(minutes.count(), 'm');
-    append(seconds.count(), 's');
+    append(years.count(), "y");
+    append(days.count(), "d");
+    append(hours.count(), "h");
+    append(minutes.count(), "m");
+    append(seconds.count(), "s");
+    append(milliseconds.count(), "ms");
 
     return res.empty() ? "0s" : res;
 }
@@ -208,6 +211,51 @@ std::string generateConfigYaml(const Settings& settings) {
     } else {
         out += "  # max_queued_requests: 0\n";
     }
+    out += "\n";
+
+    // storage
+    out += "# Cache storage settings\n";
+    out += "storage:\n";
+    out += "\n";
+    out +=
+        "  # Number of worker threads used to scan the cache directory at startup, default the "
+        "number of hardware threads\n";
+    if (settings.storage.scanThreads) {
+        out += fmt::format("  scan_threads: {}\n", *settings.storage.scanThreads);
+    } else {
+        out += "  # scan_threads: 8\n";
+    }
+    out += "\n";
+    out +=
+        "  # Number of caches for which the CONTROL and abi info is kept in memory, the info is "
+        "loaded from the zip files on demand\n";
+    out += fmt::format("  details_cache_size: {}\n", settings.storage.detailsCacheSize);
+    out += "\n";
+    out +=
+        "  # How long a lookup of a missing cache is remembered before the file system is checked "
+        "again\n";
+    out += fmt::format("  miss_cache_ttl: {}\n",
+                       formatDurationForYaml(settings.storage.missCacheTtl));
+    out += "\n";
+    out += "  # How long an unfinished resumable upload is kept after its last chunk\n";
+    out += fmt::format("  upload_session_ttl: {}\n",
+                       formatDurationForYaml(settings.storage.uploadSessionTtl));
+    out += "\n";
+    out += "  # Uploads are written to disk in chunks of this size\n";
+    out += fmt::format("  upload_buffer_size: {}\n",
+                       formatByteSizeForYaml(settings.storage.uploadBufferSize));
+    out += "\n";
+    out +=
+        "  # Write uploads with direct I/O, bypassing the page cache. Keeps uploads that are "
+        "rarely downloaded from evicting frequently downloaded caches\n";
+    out += fmt::format("  direct_uploads: {}\n", settings.storage.directUploads ? "true" : "false");
+    out += "\n";
+    out +=
+        "  # When uploads are synced to disk before they are published: none, fsync (every "
+        "upload) or group (all uploads together once every group_commit_interval)\n";
+    out += fmt::format("  durability: {}\n", enumToStr(settings.storage.durability));
+    out += fmt::format("  group_commit_interval: {}\n",
+                       formatDurationForYaml(settings.storage.groupCommitInterval));
 
     return out;
 }
@@ -292,6 +340,43 @@ void parseConfig(const std::filesystem::path& configFile, Settings& settings) {
             settings.threadPool.maxQueuedRequests = threadPool["max_queued_requests"].as<size_t>();
         }
     }
+
+    if (config["storage"]) {
+        const auto storage = config["storage"];
+        if (storage["scan_threads"]) {
+            settings.storage.scanThreads = storage["scan_threads"].as<size_t>();
+        }
+        if (storage["details_cache_size"]) {
+            settings.storage.detailsCacheSize = storage["details_cache_size"].as<size_t>();
+        }
+        if (storage["miss_cache_ttl"]) {
+            settings.storage.missCacheTtl = storage["miss_cache_ttl"].as<Duration>();
+        }
+        if (storage["upload_session_ttl"]) {
+            settings.storage.uploadSessionTtl = storage["upload_session_ttl"].as<Duration>();
+        }
+        if (storage["upload_buffer_size"]) {
+            settings.storage.uploadBufferSize = storage["upload_buffer_size"].as<ByteSize>();
+        }
+        if (storage["direct_uploads"]) {
+            settings.storage.directUploads = storage["direct_uploads"].as<bool>();
+        }
+        if (storage["durability"]) {
+            const auto durability = storage["durability"].as<std::string>();
+            if (const auto value = enumTo<Durability>{}(durability)) {
+                settings.storage.durability = *value;
+            } else {
+                throw std::runtime_error(fmt::format(
+                    "Error parsing config file: invalid durability '{}', expected none, fsync or "
+                    "group",
+                    durability));
+            }
+        }
+        if (storage["group_commit_interval"]) {
+            settings.storage.groupCommitInterval =
+                storage["group_commit_interval"].as<Duration>();
+        }
+    }
 }
 
 Settings parseArgs(int argc, char* argv[]) {
@@ -0,0 +1,52 @@
+#include <vcpkg-cache-server/sha.hpp>
+
+namespace vcache {
+
+namespace {
+
+constexpr std::optional<std::uint8_t> hexValue(char c) {
+    if (c >= '0' && c <= '9') return static_cast<std::uint8_t>(c - '0');
+    if (c >= 'a' && c <= 'f') return static_cast<std::uint8_t>(c - 'a' + 10);
+    return std::nullopt;
+}
+
+}  // namespace
+
+std::optional<Sha> Sha::parse(std::string_view hex) {
+    Sha sha;
+    if (hex.size() != sha.bytes.size() * 2) return std::nullopt;
+    for (std::size_t i = 0; i < sha.bytes.size(); ++i) {
+        const auto high = hexValue(hex[2 * i]);
+        const auto low = hexValue(hex[2 * i + 1]);
+        if (!high || !low) return std::nullopt;
+        sha.bytes[i] = static_cast<std::uint8_t>(*high << 4 | *low);
+    }
+    return sha;
+}
+
+std::string Sha::str() const {
+    static constexpr std::string_view digits = "0123456789abcdef";
+    std::string res(bytes.size() * 2, '0');
+    for (std::size_t i = 0; i < bytes.size(); ++i) {
+        res[2 * i] = digits[bytes[i] >> 4];
+        res[2 * i + 1] = digits[bytes[i] & 0xf];
+    }
+    return res;
+}
+
+std::optional<std::vector<Sha>> parseShas(std::string_view text) {
+    constexpr std::string_view separators = " \f\n\r\t\v,";
+    std::vector<Sha> shas;
+    shas.reserve(text.size() / 65 + 1);
+    for (auto pos = text.find_first_not_of(separators); pos != text.npos;
+         pos = text.find_first_not_of(separators, pos)) {
+        const auto end = std::min(text.find_first_of(separators, pos), text.size());
+        const auto sha = Sha::parse(text.substr(pos, end - pos));
+        if (!sha) return std::nullopt;
+        shas.push_back(*sha);
+        pos = end;
+    }
+    return shas;
+}
+
+}  // namespace vcache
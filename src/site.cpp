@@ -144,32 +144,54 @@ namespace site {
 
 namespace detail {
 
+namespace {
+
+/* Walk the union of the keys of two maps sorted by key */
+template <typename F>
+void forEachKey(std::span<const StringPair> map1, std::span<const StringPair> map2, F&& func) {
+    auto it1 = map1.begin();
+    auto it2 = map2.begin();
+    while (it1 != map1.end() || it2 != map2.end()) {
+        if (it2 == map2.end() || (it1 != map1.end() && it1->first < it2->first)) {
+            func(it1->first, std::optional{it1->second}, std::optional<std::string_view>{});
+            ++it1;
+        } else if (it1 == map1.end() || it2->first < it1->first) {
+            func(it2->first, std::optional<std::string_view>{}, std::optional{it2->second});
+            ++it2;
+        } else {
+            func(it1->first, std::optional{it1->second}, std::optional{it2->second});
+            ++it1;
+            ++it2;
+        }
+    }
+}
+
+std::vector<StringPair> toPairs(const std::map<std::string, std::string>& map) {
+    return map | std::views::transform([](const auto& item) {
+               return StringPair{item.first, item.second};
+           }) |
+           std::ranges::to<std::vector>();
+}
+
+}  // namespace
+
+size_t missmatches(std::span<const StringPair> map1, std::span<const StringPair> map2) {
+    size_t count = 0;
+    forEachKey(map1, map2, [&](std::string_view, const auto& val1, const auto& val2) {
+        if (val1 != val2) ++count;
+    });
+    return count;
+}
+
 size_t missmatches(const std::map<std::string, std::string>& map1,
                    const std::map<std::string, std::string>& map2) {
-    auto keys = map1 | std::views::keys | std::ranges::to<std::set>();
-    keys.insert_range(map2 | std::views::keys);
-
-    return std::transform_reduce(
-        std::begin(keys), std::end(keys), size_t{0}, std::plus<>{}, [&](const auto& key) {
-            const auto it1 = map1.find(key);
-            const auto it2 = map2.find(key);
-            if (it1 != std::end(map1) && it2 != std::end(map2) && *it1 == *it2) {
-                return size_t{0};
-            }
-            return size_t{1};
-        });
+    return missmatches(toPairs(map1), toPairs(map2));
 }
 
-std::string formatDiff(const std::map<std::string, std::string>& dstMap,
-                       const std::map<std::string, std::string>& srcMap) {
-    auto keys = dstMap | std::views::keys | std::ranges::to<std::set>();
-    keys.insert_range(srcMap | std::views::keys);
-
+std::string formatDiff(std::span<const StringPair> dstMap, std::span<const StringPair> srcMap) {
     std::string buff;
     fmt::format_to(std::back_inserter(buff), "<dl>");
-    for (const auto& key : keys) {
-        auto dst = fp::mGet(dstMap, key);
-        auto src = fp::mGet(srcMap, key);
+    forEachKey(dstMap, srcMap, [&](std::string_view key, const auto& dst, const auto& src) {
         if (dst && src) {
             if (*dst != *src) {
                 fmt::format_to(std::back_inserter(buff),
@@ -184,11 +206,16 @@ std::string formatDiff(const std::map<std::string, std::string>& dstMap,
             fmt::format_to(std::back_inserter(buff),
                            "<dt>{}</dt><dd>Missing in target <code>{}</code></dd>\n", key, *src);
         }
-    }
+    });
     fmt::format_to(std::back_inserter(buff), "</dl>");
     return buff;
 }
 
+std::string formatDiff(const std::map<std::string, std::string>& dstMap,
+                       const std::map<std::string, std::string>& srcMap) {
+    return formatDiff(toPairs(dstMap), toPairs(srcMap));
+}
+
 std::string formatMap(const std::map<std::string, std::string>& range) {
     std::string buff;
     fmt::format_to(std::back_inserter(buff), "<dl>\n");
@@ -291,7 +318,7 @@ void formatMapTo(const auto& range, std::string& buff) {
     fmt::format_to(std::back_inserter(buff), "</dl>\n");
 }
 
-void formatInfoTo(const Info& info, std::string& buff) {
+void formatInfoTo(const Info& info, const Details* details, std::string& buff) {
     fmt::format_to(std::back_inserter(buff),
                    "<h2>{}</h2><dl>"
                    "<dt>Version:</dt><dd>{}</dd>"
@@ -300,16 +327,43 @@ void formatInfoTo(const Info& info, std::string& buff) {
                    "<dt>Size:</dt><dd>{}</dd>"
                    "</dl>\n",
                    info.package, info.version, info.arch, info.time, ByteSize{info.size});
-    formatMapTo(info.ctrl, buff);
-    formatMapTo(info.abi, buff);
+    if (details) {
+        formatMapTo(details->ctrl(), buff);
+        formatMapTo(details->abi(), buff);
+    }
 }
 
-std::string formatInfo(const Info& info) {
+std::string formatInfo(const Info& info, const Details* details) {
     std::string buff;
-    formatInfoTo(info, buff);
+    formatInfoTo(info, details, buff);
     return buff;
 }
 
+struct Candidate {
+    Info info;
+    std::shared_ptr<const Details> details;
+    size_t missmatches;
+};
+
+/* Rank the other caches of package, optionally only the ones of arch, by the number of abi
+ * missmatches. The abi info of every candidate has to be loaded, so only consider the caches of
+ * the package.
+ */
+std::vector<Candidate> rankByAbi(const Store& store, std::string_view package,
+                                 std::optional<std::string_view> arch,
+                                 std::optional<Sha> excludeSha, std::span<const StringPair> abi) {
+    std::vector<Candidate> candidates;
+    for (const auto& info : store.packageInfos(package, arch)) {
+        if (info->sha == excludeSha) continue;
+        if (auto details = store.details(info->sha)) {
+            const auto count = detail::missmatches(details->abi().pairs(), abi);
+            candidates.push_back({*info, std::move(details), count});
+        }
+    }
+    std::ranges::sort(candidates, std::less<>{}, &Candidate::missmatches);
+    return candidates;
+}
+
 template <size_t N>
 struct Getter {
     template <typename T>
@@ -448,34 +502,23 @@ decltype(auto) getRowItem() {
 std::string index(const Store& store, db::Database& db, Mode mode, Sort sort,
                   std::optional<Order> maybeOrder, std::string_view search) {
     const auto order = maybeOrder.value_or(Order::Ascending);
-    const auto keys =
-        store.allInfos() | std::views::transform(&Info::package) | std::ranges::to<std::set>();
-
-    std::map<std::string, std::vector<const Info*>> packages;
-    std::ranges::for_each(store.allInfos(),
-                          [&](const Info& info) { packages[info.package].push_back(&info); });
-
+    // The store keeps the per package totals up to date, no caches are visited here
     rapidfuzz::fuzz::CachedPartialRatio<char> scorer(search);
-    auto list = packages | std::views::transform([&](const auto& package) -> RowItem {
-                    auto& [name, items] = package;
-                    const auto range =
-                        items | std::views::transform([](const auto* item) { return item->size; });
-                    const auto diskSize = std::accumulate(std::begin(range), std::end(range),
-                                                          size_t{0}, std::plus<>{});
-
-                    const auto [firstIt, lastIt] = std::ranges::minmax_element(
-                        items, std::less<>{}, [](const Info* i) { return i->time; });
-                    const auto similarity = search.empty() ? 1.0 : scorer.similarity(name);
-
-                    const auto [downloads, lastUse] = db::getPackageDownloadsAndLastUse(db, name);
-
-                    return {name,    items.size(),     diskSize,        downloads,
-                            lastUse, (*firstIt)->time, (*lastIt)->time, similarity};
+    auto list = store.packageSummaries() |
+                std::views::transform([&](const PackageSummary& package) -> RowItem {
+                    const auto similarity = search.empty() ? 1.0 : scorer.similarity(package.name);
+                    return {package.name, package.count, package.size, 0,
+                            Time{},       package.first, package.last, similarity};
                 }) |
                 std::views::filter([&](const RowItem& item) {
                     return search.empty() ? true : item.similarity > 55.0;
                 }) |
                 std::ranges::to<std::vector>();
+    // Only query the downloads of the packages that are shown
+    for (auto& item : list) {
+        std::tie(item.downloads, item.lastUse) = db::getPackageDownloadsAndLastUse(db, item.name);
+    }
+    std::ranges::sort(list, std::less<>{}, &RowItem::name);
 
     constexpr auto table = []<size_t... Is>(std::integer_sequence<size_t, Is...>) {
         return std::array{+[](decltype(list)& list, Order order) {
@@ -588,18 +631,15 @@ std::string match() {
 
 std::string match(std::string_view abi, std::string_view package, const Store& store) {
     const auto abiMap = abi | fp::splitIntoPairs('\n', ' ') | std::ranges::to<std::map>();
+    const auto abiPairs = detail::toPairs(abiMap);
 
-    auto matches = store.allInfos() |
-                   std::views::filter([&](const auto& info) { return info.package == package; }) |
-                   std::views::transform([&](const auto& info) { return info; }) |
-                   std::ranges::to<std::vector>();
-    std::ranges::sort(matches, std::less<>{},
-                      [&](const auto& info) { return detail::missmatches(info.abi, abiMap); });
+    const auto matches = rankByAbi(store, package, std::nullopt, std::nullopt, abiPairs);
 
     const auto str =
-        matches | std::views::take(3) | std::views::transform([&](const auto& info) {
-            return fmt::format("<div><h3>Time: {:%Y-%m-%d %H:%M:%S} {}</h3>{}</div>", info.time,
-                               info.sha, detail::formatDiff(abiMap, info.abi));
+        matches | std::views::take(3) | std::views::transform([&](const auto& item) {
+            return fmt::format("<div><h3>Time: {:%Y-%m-%d %H:%M:%S} {}</h3>{}</div>",
+                               item.info.time, item.info.sha,
+                               detail::formatDiff(abiPairs, item.details->abi().pairs()));
         }) |
         std::views::join | std::ranges::to<std::string>();
 
@@ -607,39 +647,43 @@ std::string match(std::string_view abi, std::string_view package, const Store& s
                        detail::formatMap(abiMap), str);
 }
 
-std::string compare(std::string_view sha, const Store& store, Mode mode) {
-    const auto* targetInfo = store.info(sha);
+std::string compare(std::string_view shaStr, const Store& store, Mode mode) {
+    const auto sha = Sha::parse(shaStr);
+    const auto targetInfo = sha ? store.info(*sha) : nullptr;
     if (!targetInfo) {
-        return detail::deliver(fmt::format("<h1>Error</h1><div>Sha: {} not found</div>", sha),
+        return detail::deliver(fmt::format("<h1>Error</h1><div>Sha: {} not found</div>", shaStr),
                                mode);
     }
 
-    const auto& abiMap = targetInfo->abi;
-    const auto& package = targetInfo->package;
+    const auto targetDetails = store.details(*sha);
+    if (!targetDetails) {
+        return detail::deliver(
+            fmt::format("<h1>Error</h1><div>Unable to load the abi info of Sha: {}</div>", *sha),
+            mode);
+    }
+    const auto abiMap = targetDetails->abi().pairs();
 
-    auto matches = store.allInfos() |
-                   std::views::filter([&](const auto& info) { return info.sha != sha; }) |
-                   std::views::filter([&](const auto& info) { return info.package == package; }) |
-                   std::views::transform([&](const auto& info) { return info; }) |
-                   std::ranges::to<std::vector>();
-    std::ranges::sort(matches, std::less<>{},
-                      [&](const auto& info) { return detail::missmatches(info.abi, abiMap); });
+    // Caches of other triplets differ in the triplet anyway, only compare the same arch
+    const auto matches =
+        rankByAbi(store, targetInfo->package, targetInfo->arch, sha, abiMap);
 
     const auto str =
-        matches | std::views::take(5) | std::views::transform([&](const auto& info) {
-            return fmt::format("<div><h3>Time: {:%Y-%m-%d %H:%M:%S} {}</h3>{}</div>", info.time,
-                               info.sha, detail::formatDiff(abiMap, info.abi));
+        matches | std::views::take(5) | std::views::transform([&](const auto& item) {
+            return fmt::format("<div><h3>Time: {:%Y-%m-%d %H:%M:%S} {}</h3>{}</div>",
+                               item.info.time, item.info.sha,
+                               detail::formatDiff(abiMap, item.details->abi().pairs()));
         }) |
         std::views::join | std::ranges::to<std::string>();
 
     const auto nav =
         detail::nav({{"Packages", "/"},
                      {targetInfo->package, fmt::format("/find/{}", targetInfo->package)},
-                     {targetInfo->sha, fmt::format("/package/{}", targetInfo->sha)},
+                     {targetInfo->sha.str(), fmt::format("/package/{}", targetInfo->sha)},
                      {"Compare", fmt::format("/compare/{}", targetInfo->sha)}});
 
-    return detail::deliver(fmt::format("{}{}<div>{}</div>", nav, formatInfo(*targetInfo), str),
-                           mode);
+    return detail::deliver(
+        fmt::format("{}{}<div>{}</div>", nav, formatInfo(*targetInfo, targetDetails.get()), str),
+        mode);
 }
 
 struct CacheItem {
@@ -649,7 +693,7 @@ struct CacheItem {
     size_t downloads;
     Time lastUse;
     Time created;
-    std::string_view sha;
+    Sha sha;
 };
 
 template <Sort S>
@@ -677,17 +721,18 @@ std::string find(std::string_view package, const Store& store, db::Database& db,
                  Sort sort, std::optional<Order> maybeOrder) {
     const auto order = maybeOrder.value_or(Order::Ascending);
 
-    auto list = store.allInfos() |
-                std::views::filter([&](const auto& info) { return info.package == package; }) |
-                std::views::transform([&](const auto& info) -> CacheItem {
-                    const auto [downloads, lastUse] = db::getCacheDownloadsAndLastUse(db, info.sha);
-                    return {.version = info.version,
-                            .arch = info.arch,
-                            .diskSize = info.size,
+    // The items reference the infos, keep them alive
+    const auto infos = store.packageInfos(package);
+    auto list = infos | std::views::transform([&](const auto& info) -> CacheItem {
+                    const auto [downloads, lastUse] =
+                        db::getCacheDownloadsAndLastUse(db, info->sha.str());
+                    return {.version = info->version,
+                            .arch = info->arch,
+                            .diskSize = info->size,
                             .downloads = downloads,
                             .lastUse = lastUse,
-                            .created = info.time,
-                            .sha = info.sha};
+                            .created = info->time,
+                            .sha = info->sha};
                 }) |
                 std::ranges::to<std::vector>();
 
@@ -761,17 +806,13 @@ std::string find(std::string_view package, const Store& store, db::Database& db,
     const auto str = list | std::views::transform([&](const CacheItem& item) {
                          return fmt::format(itemStr, item.version, item.arch,
                                             ByteSize{item.diskSize}, item.downloads, item.lastUse,
-                                            item.created, item.sha, item.sha.substr(0, 15));
+                                            item.created, item.sha, item.sha.str().substr(0, 15));
                      }) |
                      std::views::join | std::ranges::to<std::string>();
 
-    const auto sizes =
-        store.allInfos() |
-        std::views::filter([&](const auto& info) { return info.package == package; }) |
-        std::views::transform(&Info::size) | std::ranges::to<std::vector>();
-
-    const auto count = sizes.size();
-    const auto diskSize = std::accumulate(sizes.begin(), sizes.end(), size_t{0}, std::plus<>());
+    const auto count = list.size();
+    const auto diskSize = std::ranges::fold_left(list | std::views::transform(&CacheItem::diskSize),
+                                                 size_t{0}, std::plus<>{});
 
     const auto nav =
         detail::nav({{"Packages", "/"}, {std::string{package}, fmt::format("/find/{}", package)}});
@@ -784,21 +825,22 @@ std::string find(std::string_view package, const Store& store, db::Database& db,
     return detail::deliver(content, mode);
 }
 
-std::string sha(std::string_view sha, const Store& store, Mode mode) {
-    const auto* info = store.info(sha);
+std::string sha(std::string_view shaStr, const Store& store, Mode mode) {
+    const auto sha = Sha::parse(shaStr);
+    const auto info = sha ? store.info(*sha) : nullptr;
     if (!info) {
-        return detail::deliver(fmt::format("<h1>Error</h1><div>Sha: {} not found</div>", sha),
+        return detail::deliver(fmt::format("<h1>Error</h1><div>Sha: {} not found</div>", shaStr),
                                mode);
     }
-    const auto finfo = formatInfo(*info);
+    const auto finfo = formatInfo(*info, store.details(*sha).get());
     const auto nav =
         detail::nav({{"Packages", "/"},
                      {info->package, fmt::format("/find/{}", info->package)},
-                     {info->sha.substr(0, 16), fmt::format("/package/{}", info->sha)}});
+                     {info->sha.str().substr(0, 16), fmt::format("/package/{}", info->sha)}});
 
     return detail::deliver(
         fmt::format("<div>{}{}</div>{}", nav,
-                    downloadsLink({{"selcol", "sha"}, {"selval", info->sha}}), finfo),
+                    downloadsLink({{"selcol", "sha"}, {"selval", info->sha.str()}}), finfo),
         mode);
 }
 
@@ -938,11 +980,27 @@ std::string downloads(db::Database& db, Mode mode, std::optional<size_t> sortIdx
     return detail::deliver(content, mode);
 }
 
-std::string statusData() {
+std::string statusData(const Store& store) {
     const auto fds = fp::openFileDescriptors();
     const auto threads = fp::threadCount();
     const auto mem = fp::memoryUsageBytes();
     const auto pid = fp::processId();
+    const auto scan = store.scanStatus();
+
+    const auto scanStr = [&]() {
+        const auto rate =
+            static_cast<double>(scan.processed) / std::max(scan.elapsed.count(), 1e-3);
+        if (scan.done) {
+            return fmt::format("Finished, {} files ({} from index, {} failed) in {:.0f}s",
+                               scan.processed, scan.reused, scan.failed, scan.elapsed.count());
+        } else {
+            const auto percent = scan.total > 0 ? 100.0 * static_cast<double>(scan.processed) /
+                                                      static_cast<double>(scan.total)
+                                                : 0.0;
+            return fmt::format("Running, {}/{} files ({:.1f}%), {:.0f} files/s", scan.processed,
+                               scan.total, percent, rate);
+        }
+    }();
 
     static constexpr std::string_view html = R"(
         <div hx-get="/status/data" hx-trigger="every 2s" hx-swap="outerHTML">
@@ -951,18 +1009,20 @@ std::string statusData() {
                 <dt>Open file descriptors:</dt><dd>{}</dd>
                 <dt>Threads:</dt><dd>{}</dd>
                 <dt>Peak memory (RSS):</dt><dd>{}</dd>
+                <dt>Cache scan:</dt><dd>{}</dd>
             </dl>
         </div>
     )";
 
     return fmt::format(html, pid, fds ? fmt::to_string(*fds) : "N/A",
                        threads ? fmt::to_string(*threads) : "N/A",
-                       mem ? fmt::to_string(ByteSize{*mem}) : "N/A");
+                       mem ? fmt::to_string(ByteSize{*mem}) : "N/A", scanStr);
 }
 
-std::string status(Mode mode) {
+std::string status(const Store& store, Mode mode) {
     const auto nav = detail::nav({{"Packages", "/"}, {"Status", "/status"}});
-    const auto content = fmt::format("<div>{}</div><h4>Process Status</h4>{}", nav, statusData());
+    const auto content =
+        fmt::format("<div>{}</div><h4>Process Status</h4>{}", nav, statusData(store));
     return detail::deliver(content, mode);
 }
 
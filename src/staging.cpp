@@ -0,0 +1,120 @@
+#include <vcpkg-cache-server/staging.hpp>
+#include <vcpkg-cache-server/logging.hpp>
+
+#include <fmt/format.h>
+#include <fmt/std.h>
+
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace vcache {
+
+namespace {
+
+constexpr std::string_view partExtension = ".part";
+
+std::shared_ptr<UploadSession> makeSession(std::string id, const Sha& sha,
+                                           std::filesystem::path path) {
+    auto session = std::make_shared<UploadSession>();
+    session->id = std::move(id);
+    session->sha = sha;
+    session->path = std::move(path);
+    return session;
+}
+
+std::string randomId() {
+    static std::mutex mtx;
+    static std::random_device device;
+    std::scoped_lock lock{mtx};
+    std::uniform_int_distribution<std::uint64_t> dist;
+    return fmt::format("{:016x}{:016x}", dist(device), dist(device));
+}
+
+}  // namespace
+
+Staging::Staging(std::filesystem::path aDir, Duration aTtl, std::shared_ptr<spdlog::logger> aLog)
+    : dir{std::move(aDir)}, ttl{aTtl}, logger{std::move(aLog)} {
+    std::filesystem::create_directories(dir);
+
+    for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+        const auto name = entry.path().filename().string();
+        const auto [shaStr, rest] = fp::splitByFirst(name, '.');
+        const auto sha = Sha::parse(shaStr);
+        const auto id = rest.ends_with(partExtension)
+                            ? fp::remove_suffix(rest, partExtension.size())
+                            : std::string_view{};
+        if (!entry.is_regular_file() || !sha || id.empty()) {
+            log::warn(*logger, "Ignoring unknown file in the staging directory: {}", entry.path());
+            continue;
+        }
+        sessions.emplace(std::string{id}, makeSession(std::string{id}, *sha, entry.path()));
+    }
+    if (!sessions.empty()) {
+        log::info(*logger, "Restored {} upload sessions", sessions.size());
+    }
+    prune();
+}
+
+std::shared_ptr<UploadSession> Staging::create(const Sha& sha) {
+    prune();
+
+    auto id = randomId();
+    auto path = dir / fmt::format("{}.{}{}", sha, id, partExtension);
+    if (!std::ofstream{path, std::ios_base::out | std::ios_base::binary}.good()) {
+        throw std::runtime_error(fmt::format("Unable to create upload file {}", path));
+    }
+    auto session = makeSession(id, sha, std::move(path));
+    std::scoped_lock lock{mtx};
+    sessions.emplace(std::move(id), session);
+    return session;
+}
+
+std::shared_ptr<UploadSession> Staging::find(std::string_view id) const {
+    std::scoped_lock lock{mtx};
+    if (auto it = sessions.find(id); it != sessions.end()) {
+        return it->second;
+    } else {
+        return nullptr;
+    }
+}
+
+void Staging::remove(UploadSession& session) {
+    session.closed = true;
+    {
+        std::scoped_lock lock{mtx};
+        sessions.erase(session.id);
+    }
+    std::error_code ec;
+    std::filesystem::remove(session.path, ec);
+}
+
+void Staging::prune() {
+    const auto now = Clock::now();
+    std::vector<std::shared_ptr<UploadSession>> expired;
+    {
+        std::scoped_lock lock{mtx};
+        std::erase_if(sessions, [&](const auto& item) {
+            const auto& session = item.second;
+            // Sessions that are receiving a chunk right now are busy, not expired
+            std::unique_lock sessionLock{session->mtx, std::try_to_lock};
+            if (!sessionLock) return false;
+            std::error_code ec;
+            const auto time = std::filesystem::last_write_time(session->path, ec);
+            if (ec || time + ttl < now) {
+                session->closed = true;
+                expired.push_back(session);
+                return true;
+            }
+            return false;
+        });
+    }
+    for (const auto& session : expired) {
+        log::info(*logger, "Removing expired upload session {} of {}", session->id, session->sha);
+        std::error_code ec;
+        std::filesystem::remove(session->path, ec);
+    }
+}
+
+}  // namespace vcache
@@ -1,161 +1,779 @@
 #include <vcpkg-cache-server/store.hpp>
+#include <vcpkg-cache-server/index.hpp>
 #include <vcpkg-cache-server/logging.hpp>
+#include <vcpkg-cache-server/zip.hpp>
 
 #include <libzippp.h>
 
 #include <fmt/format.h>
 #include <fmt/std.h>
 
+#include <algorithm>
 #include <numeric>
 #include <ranges>
-#include <set>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
 
 namespace vcache {
 
-Store::Store(const std::filesystem::path& aRoot, std::shared_ptr<spdlog::logger> aLog)
-    : logger{aLog}, root{aRoot}, infos{} {
+Store::Store(const std::filesystem::path& aRoot, const Storage& storage,
+             std::shared_ptr<spdlog::logger> aLog)
+    : logger{aLog}
+    , root{aRoot}
+    , shards{}
+    , missCacheTtl{storage.missCacheTtl}
+    , uploadBufferSize{std::to_underlying(storage.uploadBufferSize)}
+    , directUploads{storage.directUploads}
+    , mapReads{true}
+    , uploadDir{aRoot / ".uploads"}
+    , syncer{storage.durability, storage.groupCommitInterval}
+    , detailsCache{storage.detailsCacheSize} {
 
     if (!std::filesystem::exists(aRoot)) {
         log::info(*logger, "creating cache directory {}", aRoot);
         std::filesystem::create_directories(aRoot);
     }
+    // Uploads that were interrupted by a crash or shutdown are never completed
+    if (const auto removed = std::filesystem::remove_all(uploadDir); removed > 1) {
+        log::info(*logger, "removed {} unfinished uploads", removed - 1);
+    }
+    std::filesystem::create_directories(uploadDir);
+    mapReads = fp::isLocalFileSystem(aRoot);
+    if (!mapReads) {
+        log::info(*logger, "{} is not on a local disk, caches are read without mapping", aRoot);
+    }
+
+    const auto threads = std::max(
+        size_t{1}, storage.scanThreads.value_or(std::thread::hardware_concurrency()));
+    scanStart = std::chrono::steady_clock::now();
+    scanner = std::jthread{[this, threads](std::stop_token stop) {
+        try {
+            runScan(threads, stop);
+        } catch (const std::exception& e) {
+            log::error(*logger, "Scan failed: {}", e.what());
+        }
+        {
+            std::scoped_lock lock{scanMutex};
+            scanDuration = std::chrono::steady_clock::now() - scanStart;
+            scanned = true;
+        }
+        scanCondition.notify_all();
+    }};
+}
+
+void Store::runScan(size_t threads, std::stop_token stop) {
+    auto known = [&]() {
+        ShaMap<Info> res;
+        if (!std::filesystem::exists(indexFile())) return res;
+        try {
+            auto infos = readIndex(indexFile(), mapReads);
+            res.reserve(infos.size());
+            for (auto& info : infos) {
+                const auto sha = info.sha;
+                res.try_emplace(sha, std::move(info));
+            }
+            log::info(*logger, "Loaded {} entries from index {}", res.size(), indexFile());
+        } catch (const std::exception& e) {
+            log::warn(*logger, "Unable to read index {}: {}", indexFile(), e.what());
+            res.clear();
+        }
+        return res;
+    }();
 
     log::info(*logger, "Start scan");
-    infos = scan(root, logger);
+    scan(
+        root, threads, std::move(known), progress,
+        [&](std::vector<Info>&& batch) {
+            // Entries added by uploads or on demand lookups while scanning take precedence
+            for (auto& info : batch) {
+                auto& target = shard(info.sha);
+                std::scoped_lock lock{target.mtx};
+                const auto sha = info.sha;
+                if (auto [it, inserted] = target.infos.try_emplace(
+                        sha, InfoState::Valid, std::make_shared<const Info>(std::move(info)));
+                    inserted) {
+                    packages.add(it->second.second);
+                    target.invalidate();
+                }
+            }
+        },
+        [&](const std::filesystem::path& file) {
+            // The scan only visits files named by a valid sha
+            const auto sha = *Sha::parse(file.stem().generic_string());
+            auto& target = shard(sha);
+            {
+                // Reserve the sha to make sure no upload of the same sha starts while removing
+                std::scoped_lock lock{target.mtx};
+                if (!target.infos
+                         .try_emplace(sha, InfoState::Deleting, std::make_shared<const Info>())
+                         .second) {
+                    return;
+                }
+            }
+            log::error(*logger, "removing invalid cache {}", file);
+            std::error_code ec;
+            std::filesystem::remove(file, ec);
+
+            std::scoped_lock lock{target.mtx};
+            target.infos.erase(sha);
+        },
+        logger, stop);
+
+    if (stop.stop_requested()) {
+        log::info(*logger, "Scan stopped");
+        return;
+    }
+
     log::info(*logger, "Scan finished");
     log::info(*logger, "{}", statistics());
+
+    try {
+        saveIndex();
+    } catch (const std::exception& e) {
+        log::warn(*logger, "Unable to write index {}: {}", indexFile(), e.what());
+    }
+}
+
+ScanStatus Store::scanStatus() const {
+    const bool done = scanned;
+    const auto elapsed = [&]() -> std::chrono::duration<double> {
+        if (done) {
+            std::scoped_lock lock{scanMutex};
+            return scanDuration;
+        } else {
+            return std::chrono::steady_clock::now() - scanStart;
+        }
+    }();
+    return {.done = done,
+            .total = progress.total,
+            .processed = progress.processed,
+            .reused = progress.reused,
+            .failed = progress.failed,
+            .bytes = ByteSize{progress.bytes.load()},
+            .elapsed = elapsed};
+}
+
+bool Store::waitForScan(std::stop_token stop) const {
+    std::unique_lock lock{scanMutex};
+    return scanCondition.wait(lock, stop, [&]() { return scanned.load(); });
 }
 
-bool Store::exists(std::string_view sha) const {
+bool Store::exists(const Sha& sha) const {
     return std::filesystem::is_regular_file(shaToPath(sha));
 }
 
-const Info* Store::info(std::string_view sha) {
+bool Store::known(const Sha& sha) const {
+    const auto& target = shard(sha);
+    std::shared_lock lock{target.mtx};
+    return target.infos.contains(sha);
+}
+
+std::shared_ptr<const Info> Store::info(const Sha& sha) {
+    auto& target = shard(sha);
+    const auto now = std::chrono::steady_clock::now();
     {
-        std::shared_lock lock{smtx};
-        if (auto it = infos.find(sha); it != infos.end() && it->second.first == InfoState::Valid) {
-            return &it->second.second;
+        std::shared_lock lock{target.mtx};
+        if (auto it = target.infos.find(sha); it != target.infos.end()) {
+            // Entries that are written or deleted are not looked up on disk
+            if (it->second.first == InfoState::Valid) {
+                return it->second.second;
+            } else {
+                return nullptr;
+            }
+        }
+        if (auto it = target.misses.find(sha); it != target.misses.end() && it->second > now) {
+            return nullptr;
         }
     }
 
     const auto path = shaToPath(sha);
-    if (std::filesystem::is_regular_file(path)) {
-        const auto info = extractInfo(path);
-
-        std::scoped_lock lock{smtx};
-        auto [it, inserted] = infos.try_emplace(info.sha, InfoState::Valid, info);
-        return &it->second.second;
+    if (!std::filesystem::is_regular_file(path)) {
+        std::scoped_lock lock{target.mtx};
+        // An upload might have started in the mean time, it clears the miss when done
+        if (!target.infos.contains(sha)) {
+            target.addMiss(sha, now + missCacheTtl);
+        }
+        return nullptr;
     }
 
+    auto info = std::make_shared<const Info>(extractInfo(path));
+
+    std::scoped_lock lock{target.mtx};
+    auto [it, inserted] = target.infos.try_emplace(info->sha, InfoState::Valid, info);
+    if (inserted) {
+        target.misses.erase(sha);
+        packages.add(info);
+        target.invalidate();
+    }
+    if (it->second.first == InfoState::Valid) {
+        return it->second.second;
+    }
     return nullptr;
 }
-const Info* Store::info(std::string_view sha) const {
-    std::shared_lock<std::shared_mutex> lock{smtx};
-    if (auto it = infos.find(sha); it != infos.end() && it->second.first == InfoState::Valid) {
-        return &it->second.second;
+std::shared_ptr<const Info> Store::info(const Sha& sha) const {
+    const auto& target = shard(sha);
+    std::shared_lock<std::shared_mutex> lock{target.mtx};
+    if (auto it = target.infos.find(sha);
+        it != target.infos.end() && it->second.first == InfoState::Valid) {
+        return it->second.second;
     } else {
         return nullptr;
     }
 }
 
-std::shared_ptr<StoreReader> Store::read(std::string_view sha) {
-    std::shared_lock<std::shared_mutex> lock{smtx};
+InfoList Store::infos(std::span<const Sha> shas) const {
+    // Visit the shas grouped by shard, each shard is locked once
+    std::vector<size_t> order(shas.size());
+    std::iota(order.begin(), order.end(), size_t{0});
+    std::ranges::sort(order, {}, [&](size_t i) { return shas[i].bytes[0]; });
 
-    if (auto it = infos.find(sha); it != infos.end() && it->second.first == InfoState::Valid) {
-        return std::make_shared<StoreReader>(*this, it->second, Token{});
-    } else {
+    InfoList res(shas.size());
+    for (auto it = order.begin(); it != order.end();) {
+        const auto& target = shard(shas[*it]);
+        const auto byte = shas[*it].bytes[0];
+        std::shared_lock lock{target.mtx};
+        for (; it != order.end() && shas[*it].bytes[0] == byte; ++it) {
+            if (auto found = target.infos.find(shas[*it]);
+                found != target.infos.end() && found->second.first == InfoState::Valid) {
+                res[*it] = found->second.second;
+            }
+        }
+    }
+    return res;
+}
+
+std::shared_ptr<const Details> Store::details(const Sha& sha) const {
+    {
+        std::scoped_lock lock{detailsMutex};
+        if (auto cached = detailsCache.get(sha.str())) {
+            return *cached;
+        }
+    }
+    if (!info(sha)) return nullptr;
+
+    try {
+        auto res = extractDetails(shaToPath(sha));
+        std::scoped_lock lock{detailsMutex};
+        detailsCache.put(sha.str(), res);
+        return res;
+    } catch (const std::exception& e) {
+        log::warn(*logger, "Unable to load details of {}: {}", sha, e.what());
         return nullptr;
     }
 }
 
-std::shared_ptr<StoreWriter> Store::write(std::string_view sha) {
-    std::scoped_lock lock{smtx};
+void Store::dropDetails(const Sha& sha) {
+    std::scoped_lock lock{detailsMutex};
+    detailsCache.erase(sha.str());
+}
 
-    if (auto it = infos.find(sha); it != infos.end()) {
-        if (it->second.first == InfoState::Valid || it->second.first == InfoState::Writing) {
-            return nullptr;
-        } else if (it->second.first == InfoState::Deleted) {
-            it->second.first = InfoState::Writing;
-            return std::make_shared<StoreWriter>(*this, it->second, shaToPath(sha), Token{});
+std::shared_ptr<StoreReader> Store::read(const Sha& sha) {
+    auto found = [&]() -> std::optional<std::shared_ptr<const Info>> {
+        const auto& target = shard(sha);
+        std::shared_lock<std::shared_mutex> lock{target.mtx};
+        if (auto it = target.infos.find(sha); it != target.infos.end()) {
+            if (it->second.first == InfoState::Valid) {
+                return it->second.second;
+            } else {
+                return nullptr;
+            }
         }
+        return std::nullopt;
+    }();
+
+    // While scanning, the sha might just not have been reached yet. Once the scan is done a miss
+    // is a miss, and we avoid hitting the file system for every request of a missing cache.
+    if (!found && !scanned) {
+        found = info(sha);
     }
+    if (!found || !*found) return nullptr;
 
-    const auto path = shaToPath(sha);
-    if (std::filesystem::is_regular_file(path)) {
-        auto info = extractInfo(path);
-        infos.try_emplace(info.sha, InfoState::Valid, info);
+    // The file is opened without holding the lock
+    try {
+        return std::make_shared<StoreReader>(*this, std::move(*found), Token{});
+    } catch (const std::exception& e) {
+        log::warn(*logger, "Unable to open cache {}: {}", sha, e.what());
         return nullptr;
     }
+}
 
-    auto [it, inserted] = infos.try_emplace(std::string{sha}, InfoState::Valid, Info{});
+std::shared_ptr<StoreTail> Store::tail(const Sha& sha) {
+    auto upload = [&]() -> std::shared_ptr<Upload> {
+        const auto& target = shard(sha);
+        std::shared_lock lock{target.mtx};
+        auto it = target.uploads.find(sha);
+        return it != target.uploads.end() ? it->second : nullptr;
+    }();
+    if (!upload) return nullptr;
 
-    return std::make_shared<StoreWriter>(*this, it->second, path, Token{});
+    try {
+        return std::make_shared<StoreTail>(std::move(upload), Token{});
+    } catch (const std::exception& e) {
+        log::warn(*logger, "Unable to follow upload of {}: {}", sha, e.what());
+        return nullptr;
+    }
+}
+
+bool Store::reserve(const Sha& sha) {
+    auto& target = shard(sha);
+
+    // Reserve the sha under the lock, the file system is only accessed after releasing it
+    bool checkDisk = true;
+    {
+        std::scoped_lock lock{target.mtx};
+        if (!target.infos.try_emplace(sha, InfoState::Writing, std::make_shared<const Info>())
+                 .second) {
+            return false;
+        }
+        // Recently removed or looked up caches are known not to be on disk
+        if (auto it = target.misses.find(sha); it != target.misses.end()) {
+            checkDisk = it->second <= std::chrono::steady_clock::now();
+            target.misses.erase(sha);
+        }
+    }
+
+    try {
+        // The file might be on disk but not scanned yet
+        const auto path = shaToPath(sha);
+        if (checkDisk && std::filesystem::is_regular_file(path)) {
+            release(sha, std::make_shared<const Info>(extractInfo(path)));
+            return false;
+        }
+        return true;
+    } catch (...) {
+        release(sha, nullptr);
+        throw;
+    }
+}
+
+void Store::release(const Sha& sha, std::shared_ptr<const Info> info) {
+    auto& target = shard(sha);
+    std::scoped_lock lock{target.mtx};
+    if (info) {
+        packages.add(info);
+        target.infos.find(sha)->second = {InfoState::Valid, std::move(info)};
+        target.invalidate();
+    } else {
+        target.infos.erase(sha);
+    }
+}
+
+std::shared_ptr<StoreWriter> Store::write(const Sha& sha, std::optional<size_t> expectedSize) {
+    if (!reserve(sha)) return nullptr;
+    try {
+        return std::make_shared<StoreWriter>(*this, sha, shaToPath(sha), expectedSize, Token{});
+    } catch (...) {
+        release(sha, nullptr);
+        throw;
+    }
+}
+
+std::shared_ptr<const Info> Store::commit(const Sha& sha, const std::filesystem::path& staged) {
+    if (!reserve(sha)) return nullptr;
+
+    // Validated and synced like an upload. The cache is never registered as an upload, there is
+    // no file in the uploads directory that readers could start to follow.
+    const auto path = shaToPath(sha);
+    bool published = false;
+    try {
+        auto info = std::make_shared<const Info>(extractInfo(staged, sha));
+        syncer.sync(staged);
+        std::filesystem::create_directories(path.parent_path());
+        std::filesystem::rename(staged, path);
+        published = true;
+        syncer.sync(path.parent_path());
+        dropDetails(sha);
+        release(sha, info);
+        return info;
+    } catch (...) {
+        if (published) {
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+        }
+        release(sha, nullptr);
+        throw;
+    }
 }
 
 std::string Store::statistics() const {
-    const auto diskSize = std::ranges::fold_left(allInfos() | std::views::transform(&Info::size),
-                                                 size_t{0}, std::plus<>{});
-    const auto packages =
-        allInfos() | std::views::transform(&Info::package) | std::ranges::to<std::set>();
+    const auto [caches, packageCount, diskSize] = totals();
+    return fmt::format("Found {} caches of {} packages. Using {}. Interned {} strings using {}",
+                       caches, packageCount, ByteSize{diskSize},
+                       StringPool::global().size(), StringPool::global().bytes());
+}
+
+void Store::saveIndex() const {
+    const auto data = [&]() {
+        auto all = allInfos();
+        const auto ptrs =
+            all | std::views::transform([](const Info& info) { return &info; }) |
+            std::ranges::to<std::vector>();
+        return encodeIndex(ptrs);
+    }();
+    writeIndex(indexFile(), data);
+}
+
+std::filesystem::path Store::indexFile() const { return root / ".vcache.index"; }
+
+std::shared_ptr<const InfoList> Store::Shard::validInfos() const {
+    std::shared_lock lock{mtx};
+    std::scoped_lock snapshotLock{snapshotMutex};
+    if (!snapshot) {
+        auto list = std::make_shared<InfoList>();
+        for (const auto& [sha, item] : infos) {
+            if (item.first == InfoState::Valid) {
+                list->push_back(item.second);
+            }
+        }
+        snapshot = std::move(list);
+    }
+    return snapshot;
+}
 
-    return fmt::format("Found {} caches of {} packages. Using {}", infos.size(), packages.size(),
-                       ByteSize{diskSize});
+void Store::Shard::addMiss(const Sha& sha, std::chrono::steady_clock::time_point until) {
+    // Bound the memory used by lookups of random shas, drop expired misses first
+    constexpr size_t maxMisses = 4096;
+    if (misses.size() >= maxMisses) {
+        const auto now = std::chrono::steady_clock::now();
+        ShaMap<std::chrono::steady_clock::time_point> alive;
+        for (const auto& [key, time] : misses) {
+            if (time > now) alive.try_emplace(key, time);
+        }
+        misses = alive.size() < maxMisses / 2 ? std::move(alive) : decltype(misses){};
+    }
+    misses.try_emplace(sha, until).first->second = until;
 }
 
-std::filesystem::path Store::shaToPath(std::string_view sha) const {
-    return root / sha.substr(0, 2) / fmt::format("{}.zip", sha);
+void Store::Shard::invalidate() {
+    std::scoped_lock snapshotLock{snapshotMutex};
+    snapshot.reset();
 }
 
-void Store::remove(std::string_view sha) {
-    std::scoped_lock lock{smtx};
-    if (auto it = infos.find(sha); it != infos.end()) {
-        if (it->second.first == InfoState::Valid) {
-            it->second.first = InfoState::Deleted;
-            const auto path = shaToPath(sha);
+void Store::PackageIndex::add(const std::shared_ptr<const Info>& info) {
+    std::scoped_lock lock{mtx};
+    auto [it, added] = packages.try_emplace(info->package);
+    auto& package = it->second;
+    if (added) {
+        package.summary = table.size();
+        table.push_back({.name = info->package});
+    }
+    if (!package.archs.try_emplace(info->arch).first->second.try_emplace(info->sha, info).second) {
+        return;
+    }
+
+    auto& summary = table[package.summary];
+    ++summary.count;
+    summary.size += info->size;
+    summary.first = std::min(summary.first, info->time);
+    summary.last = std::max(summary.last, info->time);
+    ++totalCount;
+    totalSize += info->size;
+}
 
-            log::info(*logger, "Deleting: {}", path);
-            std::filesystem::remove(path);
+void Store::PackageIndex::remove(const Info& info) {
+    std::scoped_lock lock{mtx};
+    const auto package = packages.find(info.package);
+    if (package == packages.end()) return;
+    auto& archs = package->second.archs;
+    const auto arch = archs.find(info.arch);
+    if (arch == archs.end() || arch->second.erase(info.sha) == 0) return;
+
+    --totalCount;
+    totalSize -= info.size;
+    if (arch->second.empty()) {
+        archs.erase(arch);
+    }
+
+    const auto index = package->second.summary;
+    if (archs.empty()) {
+        // Move the last summary into the gap to keep the table contiguous
+        if (index + 1 != table.size()) {
+            table[index] = std::move(table.back());
+            packages.find(table[index].name)->second.summary = index;
+        }
+        table.pop_back();
+        packages.erase(package);
+        return;
+    }
+
+    auto& summary = table[index];
+    --summary.count;
+    summary.size -= info.size;
+    if (info.time == summary.first || info.time == summary.last) {
+        // The removed cache bounded the time range, find the new bounds in the package
+        summary.first = Time::max();
+        summary.last = Time::min();
+        for (const auto& [name, infos] : archs) {
+            for (const auto& [sha, item] : infos) {
+                summary.first = std::min(summary.first, item->time);
+                summary.last = std::max(summary.last, item->time);
+            }
         }
     }
 }
 
-fp::UnorderedStringMap<std::pair<InfoState, Info>> scan(const std::filesystem::path& path,
-                                                        std::shared_ptr<spdlog::logger> logger) {
-    return std::filesystem::recursive_directory_iterator(path) | std::views::filter(fp::isZipFile) |
-           fp::tryTransform(
-               [&](const auto& entry) {
-                   log::trace(*logger, "scan: {}", entry.path().stem().generic_string());
-                   return extractInfo(entry.path());
-               },
-               [&](const auto& entry) {
-                   log::error(*logger, "error scaning {} : {}, removing entry", entry.path(),
-                              fp::exceptionToString());
-                   std::filesystem::remove(entry.path());
-               }) |
-           std::views::transform([&](auto&& info) {
-               return std::pair<const std::string, std::pair<InfoState, Info>>{
-                   info.sha, {InfoState::Valid, info}};
-           }) |
-           std::ranges::to<fp::UnorderedStringMap<std::pair<InfoState, Info>>>();
+InfoList Store::PackageIndex::find(std::string_view package,
+                                   std::optional<std::string_view> arch) const {
+    std::shared_lock lock{mtx};
+    InfoList res;
+    const auto it = packages.find(package);
+    if (it == packages.end()) return res;
+    for (const auto& [name, infos] : it->second.archs) {
+        if (arch && name != *arch) continue;
+        for (const auto& [sha, info] : infos) {
+            res.push_back(info);
+        }
+    }
+    return res;
 }
 
-Info extractInfo(const std::filesystem::path& path) {
-    libzippp::ZipArchive zf{path.generic_string()};
+std::vector<PackageSummary> Store::PackageIndex::summaries() const {
+    std::shared_lock lock{mtx};
+    return table;
+}
+
+StoreTotals Store::PackageIndex::totals() const {
+    std::shared_lock lock{mtx};
+    return {.caches = totalCount, .packages = table.size(), .size = totalSize};
+}
+
+InfoList Store::packageInfos(std::string_view package,
+                             std::optional<std::string_view> arch) const {
+    return packages.find(package, arch);
+}
+
+std::vector<PackageSummary> Store::packageSummaries() const { return packages.summaries(); }
+
+StoreTotals Store::totals() const { return packages.totals(); }
+
+size_t Store::size() const {
+    return std::ranges::fold_left(shards | std::views::transform([](const Shard& item) {
+                                      std::shared_lock lock{item.mtx};
+                                      return item.infos.size();
+                                  }),
+                                  size_t{0}, std::plus<>{});
+}
+
+std::filesystem::path Store::shaToPath(const Sha& sha) const {
+    const auto str = sha.str();
+    return root / str.substr(0, 2) / fmt::format("{}.zip", str);
+}
+
+std::filesystem::path Store::uploadPath(const Sha& sha) const {
+    return uploadDir / fmt::format("{}.tmp", sha);
+}
+
+void Store::remove(const Sha& sha) {
+    auto& target = shard(sha);
+    {
+        std::scoped_lock lock{target.mtx};
+        auto it = target.infos.find(sha);
+        if (it == target.infos.end() || it->second.first != InfoState::Valid) {
+            return;
+        }
+        it->second.first = InfoState::Deleting;
+        packages.remove(*it->second.second);
+        target.invalidate();
+    }
+    dropDetails(sha);
+
+    const auto path = shaToPath(sha);
+    log::info(*logger, "Deleting: {}", path);
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+    if (ec) {
+        log::error(*logger, "Unable to delete {}: {}", path, ec.message());
+    }
+
+    // Readers of the cache keep their info alive, the entry itself is dropped
+    std::scoped_lock lock{target.mtx};
+    if (ec) {
+        auto& item = target.infos.find(sha)->second;
+        item.first = InfoState::Valid;
+        packages.add(item.second);
+        target.invalidate();
+    } else {
+        target.infos.erase(sha);
+        target.addMiss(sha, std::chrono::steady_clock::now() + missCacheTtl);
+    }
+}
+
+void scan(const std::filesystem::path& path, size_t threads, ShaMap<Info> known,
+          ScanProgress& progress, const std::function<void(std::vector<Info>&&)>& found,
+          const std::function<void(const std::filesystem::path&)>& failed,
+          std::shared_ptr<spdlog::logger> logger, std::stop_token stop) {
+    using namespace std::chrono;
+    const auto start = steady_clock::now();
+    constexpr size_t batchSize = 256;
+
+    // Walking the directory tree is cheap compared to opening the zip files, collect all the paths
+    // first and let the workers pick them from the list. Files not named by a sha, or not in the
+    // directory of their sha, can not be looked up and are left alone.
+    const auto validName = [&](const std::filesystem::path& file) {
+        const auto sha = Sha::parse(file.stem().generic_string());
+        if (!sha) {
+            log::warn(*logger, "scan: skipping {}, the name is not a sha", file);
+            return false;
+        }
+        const auto str = sha->str();
+        const auto expected = std::filesystem::path{str.substr(0, 2)} / fmt::format("{}.zip", str);
+        if (file.lexically_relative(path) != expected) {
+            log::warn(*logger, "scan: skipping {}, it is not at the location of its sha", file);
+            return false;
+        }
+        return true;
+    };
+    const auto files = std::filesystem::recursive_directory_iterator(path) |
+                       std::views::filter(fp::isZipFile) |
+                       std::views::transform([](const auto& entry) { return entry.path(); }) |
+                       std::views::filter(validName) | std::ranges::to<std::vector>();
+    progress.total = files.size();
+
+    log::info(*logger, "scan: found {} files, extracting using {} threads", files.size(), threads);
+
+    std::atomic<size_t> next{0};
+    {
+        std::vector<std::jthread> workers;
+        for (size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&]() {
+                std::vector<Info> batch;
+                for (auto i = next++; i < files.size() && !stop.stop_requested(); i = next++) {
+                    const auto& file = files[i];
+                    try {
+                        const auto sha = *Sha::parse(file.stem().generic_string());
+                        // Only the file at the location of its sha is visited, so each sha is
+                        // handled by one worker and moving from known is safe here.
+                        if (auto it = known.find(sha);
+                            it != known.end() &&
+                            it->second.size == std::filesystem::file_size(file) &&
+                            it->second.time == std::filesystem::last_write_time(file)) {
+                            batch.push_back(std::move(it->second));
+                            ++progress.reused;
+                        } else {
+                            log::trace(*logger, "scan: {}", sha);
+                            batch.push_back(extractInfo(file));
+                        }
+                        progress.bytes += batch.back().size;
+                    } catch (...) {
+                        ++progress.failed;
+                        log::error(*logger, "error scaning {} : {}", file, fp::exceptionToString());
+                        failed(file);
+                    }
+                    if (batch.size() >= batchSize) {
+                        found(std::move(batch));
+                        batch.clear();
+                    }
+                    if (const auto processed = ++progress.processed; processed % 10'000 == 0) {
+                        const auto secs = duration<double>(steady_clock::now() - start).count();
+                        log::info(*logger, "scan: {}/{} files, {:.0f} files/s", processed,
+                                  files.size(), static_cast<double>(processed) / secs);
+                    }
+                }
+                if (!batch.empty()) {
+                    found(std::move(batch));
+                }
+            });
+        }
+    }
+
+    const auto secs = duration<double>(steady_clock::now() - start).count();
+    log::info(*logger,
+              "scan: processed {} files ({} from index, {} failed) of {} in {:.1f}s, "
+              "{:.0f} files/s",
+              progress.processed.load(), progress.reused.load(), progress.failed.load(),
+              ByteSize{progress.bytes.load()}, secs,
+              static_cast<double>(progress.processed) / std::max(secs, 1e-3));
+}
+
+ShaMap<std::pair<InfoState, Info>> scan(const std::filesystem::path& path, size_t threads,
+                                        ShaMap<Info> known,
+                                        std::shared_ptr<spdlog::logger> logger) {
+    std::mutex mutex;
+    ShaMap<std::pair<InfoState, Info>> infos;
+    ScanProgress progress;
+    scan(
+        path, threads, std::move(known), progress,
+        [&](std::vector<Info>&& batch) {
+            std::scoped_lock lock{mutex};
+            for (auto& info : batch) {
+                const auto sha = info.sha;
+                infos.try_emplace(sha, InfoState::Valid, std::move(info));
+            }
+        },
+        [&](const std::filesystem::path& file) {
+            log::error(*logger, "removing invalid cache {}", file);
+            std::error_code ec;
+            std::filesystem::remove(file, ec);
+        },
+        logger);
+    return infos;
+}
+
+namespace {
+
+/* Split text into key value pairs, the keys are interned and the values reference text */
+StringMap parsePairs(std::string_view text, char lineSep, char sep) {
+    std::vector<StringPair> pairs;
+    for (const auto line : std::views::split(text, lineSep)) {
+        const auto str = std::string_view{line.begin(), line.end()};
+        if (!fp::nonSpace(str)) continue;
+        const auto [key, value] = fp::splitByFirst(str, sep);
+        pairs.emplace_back(StringPool::global().intern(fp::trim(key)), fp::trim(value));
+    }
+    return StringMap::fromViews(std::move(pairs));
+}
+
+constexpr std::string_view abiFile = "vcpkg_abi_info.txt";
+
+std::string abiPath(std::string_view ctrlText) {
+    const auto package = fp::mGet(parsePairs(ctrlText, '\n', ':'), "Package").value_or("?");
+    return fmt::format("share/{}/{}", package, abiFile);
+}
+
+/* The CONTROL text and, if requested, the abi info text of a cache. Both files are required,
+ * the abi info is looked for at its usual location first and then anywhere in the archive.
+ */
+struct CacheTexts {
+    std::string ctrl;
+    std::string abi;
+};
+
+CacheTexts readTexts(const ZipReader& zip, bool readAbi) {
+    const auto ctrl = zip.find("CONTROL");
+    if (!ctrl) {
+        throw std::runtime_error{"missing CONTROL file"};
+    }
+    CacheTexts res{.ctrl = zip.read(*ctrl), .abi = {}};
+
+    auto abi = zip.find(abiPath(res.ctrl));
+    if (!abi) {
+        abi = zip.findIf(fp::endsWith(abiFile));
+    }
+    if (!abi) {
+        throw std::runtime_error{"missing vcpkg_abi_info.txt file"};
+    }
+    if (readAbi) {
+        res.abi = zip.read(*abi);
+    }
+    return res;
+}
+
+CacheTexts readTexts(libzippp::ZipArchive& zf, const std::filesystem::path& path, bool readAbi) {
     if (!zf.open(libzippp::ZipArchive::ReadOnly)) {
         throw std::runtime_error(fmt::format("Unable to open file {}", path));
     }
-
-    auto ctrl = zf.getEntry("CONTROL");
+    const auto ctrl = zf.getEntry("CONTROL");
     if (ctrl.isNull()) {
         throw std::runtime_error{"missing CONTROL file"};
     }
-    auto ctrlMap = ctrl.readAsText() | fp::splitIntoPairs('\n', ':') | std::ranges::to<std::map>();
+    CacheTexts res{.ctrl = ctrl.readAsText(), .abi = {}};
 
-    auto abi = zf.getEntry(
-        fmt::format("share/{}/vcpkg_abi_info.txt", fp::mGet(ctrlMap, "Package").value_or("?")));
+    auto abi = zf.getEntry(abiPath(res.ctrl));
     if (abi.isNull()) {
         auto entries = zf.getEntries();
-        if (auto it = std::ranges::find_if(entries, fp::endsWith("vcpkg_abi_info.txt"),
+        if (auto it = std::ranges::find_if(entries, fp::endsWith(abiFile),
                                            &libzippp::ZipEntry::getName);
             it != entries.end()) {
             abi = *it;
@@ -163,44 +781,287 @@ Info extractInfo(const std::filesystem::path& path) {
             throw std::runtime_error{"missing vcpkg_abi_info.txt file"};
         }
     }
-    auto abiMap = abi.readAsText() | fp::splitIntoPairs('\n', ' ') | std::ranges::to<std::map>();
+    if (readAbi) {
+        res.abi = abi.readAsText();
+    }
+    return res;
+}
+
+CacheTexts readCache(const std::filesystem::path& path, bool readAbi) {
+    // The fast reader only parses the central directory and inflates the two files we need,
+    // libzip handles anything it does not support. Files on network file systems are not mapped,
+    // like in StoreReader.
+    try {
+        return readTexts(ZipReader{path, fp::isLocalFileSystem(path)}, readAbi);
+    } catch (const std::exception&) {
+    }
+    libzippp::ZipArchive zf{path.generic_string()};
+    return readTexts(zf, path, readAbi);
+}
 
-    return {.package = fp::mGet(ctrlMap, "Package").value_or("?"),
-            .version = fp::mGet(ctrlMap, "Version").value_or("?"),
-            .arch = fp::mGet(ctrlMap, "Architecture").value_or("?"),
-            .sha = path.stem().generic_string(),
-            .ctrl = ctrlMap,
-            .abi = abiMap,
+}  // namespace
+
+Details::Details(std::string aCtrlText, std::string aAbiText)
+    : ctrlText{std::move(aCtrlText)}
+    , abiText{std::move(aAbiText)}
+    , ctrlMap{parsePairs(ctrlText, '\n', ':')}
+    , abiMap{parsePairs(abiText, '\n', ' ')} {}
+
+Info extractInfo(const std::filesystem::path& path, const Sha& sha) {
+    // Only check that the abi info exists, it is read on demand by extractDetails
+    const auto texts = readCache(path, false);
+    const auto ctrl = parsePairs(texts.ctrl, '\n', ':');
+
+    return {.package = std::string{fp::mGet(ctrl, "Package").value_or("?")},
+            .version = std::string{fp::mGet(ctrl, "Version").value_or("?")},
+            .arch = std::string{fp::mGet(ctrl, "Architecture").value_or("?")},
+            .sha = sha,
             .time = std::filesystem::last_write_time(path),
             .size = std::filesystem::file_size(path)};
 }
 
-StoreWriter::StoreWriter(Store& store, std::pair<InfoState, Info>& infoItem,
-                         const std::filesystem::path& path, typename Store::Token)
-    : store{store}, infoItem{infoItem}, path{path}, stream{[&]() {
-        std::filesystem::create_directories(path.parent_path());
-        return std::ofstream{path, std::ios_base::out | std::ios_base::binary};
-    }()} {
+Info extractInfo(const std::filesystem::path& path) {
+    const auto sha = Sha::parse(path.stem().generic_string());
+    if (!sha) {
+        throw std::runtime_error(fmt::format("The name of {} is not a sha", path));
+    }
+    return extractInfo(path, *sha);
+}
 
-    if (!stream.good()) {
-        throw std::runtime_error(fmt::format("Unable to open file for writing {}", path));
+std::shared_ptr<const Details> extractDetails(const std::filesystem::path& path) {
+    auto texts = readCache(path, true);
+    return std::make_shared<const Details>(std::move(texts.ctrl), std::move(texts.abi));
+}
+
+Syncer::Syncer(Durability aDurability, Duration aInterval)
+    : durability{aDurability}, interval{aInterval} {
+    if (durability == Durability::Group) {
+        thread = std::jthread{[this](std::stop_token stop) { run(stop); }};
+    }
+}
+
+void Syncer::sync(const std::filesystem::path& path) {
+    switch (durability) {
+        case Durability::None:
+            return;
+        case Durability::Fsync:
+            fp::syncFile(path);
+            return;
+        case Durability::Group:
+            break;
+    }
+
+    auto request = std::make_shared<Request>(path);
+    std::unique_lock lock{mtx};
+    // Nobody is left to serve the request once the thread has been stopped
+    if (thread.get_stop_token().stop_requested()) {
+        lock.unlock();
+        fp::syncFile(path);
+        return;
+    }
+    pending.push_back(request);
+    changed.notify_all();
+    changed.wait(lock, [&]() { return request->done; });
+    if (request->error) std::rethrow_exception(request->error);
+}
+
+void Syncer::run(std::stop_token stop) {
+    std::unique_lock lock{mtx};
+    while (true) {
+        changed.wait(lock, stop, [&]() { return !pending.empty(); });
+        // The requests left when stopping are still synced
+        if (pending.empty()) return;
+        // Collect the requests arriving during the interval into the same round
+        changed.wait_for(lock, stop, interval, []() { return false; });
+        const auto round = std::exchange(pending, {});
+        lock.unlock();
+
+        // Directories are shared by many uploads, each path is synced once per round
+        auto paths = round |
+                     std::views::transform([](const auto& request) { return request->path; }) |
+                     std::ranges::to<std::vector>();
+        std::ranges::sort(paths);
+        paths.erase(std::ranges::unique(paths).begin(), paths.end());
+        const auto errors = fp::syncAll(paths);
+
+        lock.lock();
+        for (const auto& request : round) {
+            const auto it = std::ranges::lower_bound(paths, request->path);
+            request->error = errors[static_cast<size_t>(it - paths.begin())];
+            request->done = true;
+        }
+        changed.notify_all();
+    }
+}
+
+void Upload::advance(size_t size) {
+    {
+        std::scoped_lock lock{mtx};
+        written = size;
+    }
+    changed.notify_all();
+}
+
+void Upload::finish(State result, size_t size) {
+    {
+        std::scoped_lock lock{mtx};
+        state = result;
+        written = size;
+    }
+    changed.notify_all();
+}
+
+std::pair<size_t, Upload::State> Upload::wait(size_t offset,
+                                              std::chrono::steady_clock::duration timeout) const {
+    std::unique_lock lock{mtx};
+    changed.wait_for(lock, timeout, [&]() { return written > offset || state != State::Running; });
+    return {written, state};
+}
+
+StoreReader::StoreReader(Store& store, std::shared_ptr<const Info> aInfo, typename Store::Token)
+    : info{std::move(aInfo)} {
+    const auto path = store.shaToPath(info->sha);
+    if (store.mapReads) {
+        mapped.emplace(path);
+    } else {
+        file.open(path, std::ios_base::in | std::ios_base::binary);
+        if (!file.good()) {
+            throw std::runtime_error(fmt::format("Unable to open file for reading {}", path));
+        }
+    }
+}
+
+size_t StoreReader::read(size_t offset, std::span<char> buffer) {
+    if (mapped) {
+        const auto data = mapped->data().subspan(std::min(offset, mapped->size()));
+        const auto size = std::min(buffer.size(), data.size());
+        std::copy_n(data.data(), size, buffer.data());
+        return size;
+    }
+    file.clear();
+    file.seekg(static_cast<std::streamoff>(offset));
+    file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    if (file.bad()) {
+        throw std::runtime_error(fmt::format("Unable to read cache {}", info->sha));
+    }
+    return static_cast<size_t>(file.gcount());
+}
+
+StoreTail::StoreTail(std::shared_ptr<Upload> aUpload, typename Store::Token)
+    : upload{std::move(aUpload)}, file{upload->path, std::ios_base::in | std::ios_base::binary} {
+    // The commit might have renamed the file already
+    if (!file.good()) {
+        file.clear();
+        file.open(upload->target, std::ios_base::in | std::ios_base::binary);
     }
+    if (!file.good()) {
+        throw std::runtime_error(fmt::format("Unable to open file for reading {}", upload->path));
+    }
+    ++upload->followers;
+}
+
+StoreTail::~StoreTail() { --upload->followers; }
+
+size_t StoreTail::read(size_t offset, std::span<char> buffer) {
+    // The writer is disconnected by the server long before this when its client stops sending
+    constexpr auto stallTimeout = std::chrono::minutes{5};
+    const auto [available, state] = upload->wait(offset, stallTimeout);
+    if (state == Upload::State::Failed) {
+        throw std::runtime_error(fmt::format("Upload of {} failed", upload->path));
+    }
+    if (offset >= available) {
+        if (state == Upload::State::Committed) return 0;
+        throw std::runtime_error(fmt::format("Upload of {} stalled", upload->path));
+    }
+
+    const auto size = std::min(buffer.size(), available - offset);
+    // A previous read might have reached the end of the file while it was growing
+    file.clear();
+    file.seekg(static_cast<std::streamoff>(offset));
+    file.read(buffer.data(), static_cast<std::streamsize>(size));
+    if (static_cast<size_t>(file.gcount()) != size) {
+        throw std::runtime_error(fmt::format("Unable to read upload {}", upload->path));
+    }
+    return size;
+}
+
+StoreWriter::StoreWriter(Store& store, const Sha& sha, const std::filesystem::path& path,
+                         std::optional<size_t> expectedSize, typename Store::Token)
+    : store{store}
+    , sha{sha}
+    , path{path}
+    , tmpPath{store.uploadPath(sha)}
+    , file{tmpPath, expectedSize, store.uploadBufferSize, store.directUploads}
+    , upload{std::make_shared<Upload>(tmpPath, path, expectedSize)} {
+
+    auto& target = store.shard(sha);
+    std::scoped_lock lock{target.mtx};
+    target.uploads.try_emplace(sha, upload);
 }
 
 StoreWriter::~StoreWriter() {
+    if (!done) discard();
+}
+
+void StoreWriter::write(const char* data, size_t size) {
+    file.write({data, size});
+    // Without followers the data stays in the buffer until it is full
+    if (upload->followers > 0) {
+        upload->advance(file.flush());
+    }
+}
+
+std::shared_ptr<const Info> StoreWriter::commit() {
+    bool published = false;
     try {
-        stream.close();
-        if (!stream.good()) {
-            throw std::runtime_error(fmt::format("Unable to close file {}", path));
-        }
-        infoItem.second = extractInfo(path);
+        file.close();
+        // Only valid caches are published, the data is on disk before the rename makes it
+        // visible and the rename is on disk before the upload is confirmed
+        auto info = std::make_shared<const Info>(extractInfo(tmpPath));
+        store.syncer.sync(tmpPath);
+        std::filesystem::create_directories(path.parent_path());
+        std::filesystem::rename(tmpPath, path);
+        published = true;
+        store.syncer.sync(path.parent_path());
+        store.dropDetails(sha);
         {
-            std::scoped_lock lock{store.smtx};
-            infoItem.first = InfoState::Valid;
+            // Look the entry up again, other insertions into the shard might have moved it
+            auto& target = store.shard(sha);
+            std::scoped_lock lock{target.mtx};
+            auto& item = target.infos.try_emplace(sha).first->second;
+            store.packages.add(info);
+            item.second = info;
+            item.first = InfoState::Valid;
+            target.uploads.erase(sha);
+            target.invalidate();
         }
-    } catch (const std::exception& e) {
-        log::error(*store.logger, "Unable to close writer of: {} due to: {}", path, e.what());
+        done = true;
+        upload->finish(Upload::State::Committed, info->size);
+        return info;
+    } catch (...) {
+        if (published) {
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+        }
+        discard();
+        throw;
+    }
+}
+
+void StoreWriter::discard() noexcept {
+    done = true;
+    upload->finish(Upload::State::Failed, file.size());
+    file.discard();
+    std::error_code ec;
+    std::filesystem::remove(tmpPath, ec);
+    if (ec) {
+        log::error(*store.logger, "Unable to remove discarded upload {}: {}", tmpPath,
+                   ec.message());
     }
+    auto& target = store.shard(sha);
+    std::scoped_lock lock{target.mtx};
+    target.infos.erase(sha);
+    target.uploads.erase(sha);
 }
 
 }  // namespace vcache
@@ -0,0 +1,252 @@
+#include <vcpkg-cache-server/tar.hpp>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <stdexcept>
+#include <utility>
+
+namespace vcache {
+
+namespace {
+
+constexpr std::array<char, 2 * tarBlockSize> zeros{};
+
+constexpr std::uint64_t paddedSize(std::uint64_t size) {
+    return (size + tarBlockSize - 1) / tarBlockSize * tarBlockSize;
+}
+
+// Write value as a zero terminated octal number filling field
+void putOctal(std::span<char> field, std::uint64_t value) {
+    fmt::format_to_n(field.data(), field.size() - 1, "{:0{}o}", value, field.size() - 1);
+    field.back() = '\0';
+}
+
+// Parse an octal or base-256 numeric header field
+std::uint64_t getNumber(std::string_view field) {
+    if (!field.empty() && static_cast<unsigned char>(field[0]) & 0x80) {
+        std::uint64_t value = 0;
+        for (const auto c : field.substr(1)) {
+            if (value >> 56) throw std::runtime_error("Tar header number out of range");
+            value = value << 8 | static_cast<unsigned char>(c);
+        }
+        return value;
+    }
+    // Octal digits, optionally surrounded by spaces and terminated by a zero
+    auto digits = field.substr(0, field.find('\0'));
+    digits.remove_prefix(std::min(digits.find_first_not_of(' '), digits.size()));
+    digits = digits.substr(0, digits.find(' '));
+    std::uint64_t value = 0;
+    const auto [ptr, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), value, 8);
+    if (digits.empty() || ec != std::errc{} || ptr != digits.data() + digits.size()) {
+        throw std::runtime_error(fmt::format("Invalid tar header number '{}'", field));
+    }
+    return value;
+}
+
+std::string_view getString(std::string_view field) { return field.substr(0, field.find('\0')); }
+
+std::int64_t unixTime(Time time) {
+#ifdef _LIBCPP_VERSION
+    const auto sysTime = Clock::to_sys(time);
+#else
+    const auto sysTime = std::chrono::clock_cast<std::chrono::system_clock>(time);
+#endif
+    return std::chrono::floor<std::chrono::seconds>(sysTime).time_since_epoch().count();
+}
+
+}  // namespace
+
+std::array<char, tarBlockSize> tarHeader(std::string_view name, std::uint64_t size, Time mtime) {
+    std::array<char, tarBlockSize> header{};
+    const auto field = [&](std::size_t offset, std::size_t length) {
+        return std::span{header}.subspan(offset, length);
+    };
+    if (name.empty() || name.size() > 100) {
+        throw std::invalid_argument(fmt::format("Invalid tar entry name '{}'", name));
+    }
+    std::ranges::copy(name, header.begin());
+    putOctal(field(100, 8), 0644);  // mode
+    putOctal(field(108, 8), 0);     // uid
+    putOctal(field(116, 8), 0);     // gid
+
+    constexpr std::uint64_t maxOctal = (std::uint64_t{1} << 33) - 1;
+    if (size <= maxOctal) {
+        putOctal(field(124, 12), size);
+    } else {
+        // Base-256, a set high bit followed by the big endian value
+        auto sizeField = field(124, 12);
+        sizeField[0] = static_cast<char>(0x80);
+        for (std::size_t i = 0; i < 8; ++i) {
+            sizeField[11 - i] = static_cast<char>((size >> (8 * i)) & 0xff);
+        }
+    }
+    const auto seconds = std::max(std::int64_t{0}, unixTime(mtime));
+    putOctal(field(136, 12), static_cast<std::uint64_t>(seconds));
+    header[156] = '0';  // regular file
+    std::ranges::copy(std::string_view{"ustar"}, header.begin() + 257);
+    std::ranges::copy(std::string_view{"00"}, header.begin() + 263);
+
+    // The checksum is computed with the checksum field set to spaces
+    std::ranges::fill(field(148, 8), ' ');
+    unsigned checksum = 0;
+    for (const auto c : header) checksum += static_cast<unsigned char>(c);
+    putOctal(field(148, 7), checksum);
+    return header;
+}
+
+void TarStream::add(std::string_view name, Time mtime, std::span<const char> data,
+                    std::shared_ptr<const void> owner) {
+    entries.push_back({tarHeader(name, data.size(), mtime), data.size(), data, nullptr,
+                       std::move(owner)});
+    offsets.push_back(offsets.back() + tarBlockSize + paddedSize(data.size()));
+}
+
+void TarStream::add(std::string_view name, Time mtime, std::uint64_t size, ReadFunction read) {
+    entries.push_back({tarHeader(name, size, mtime), size, {}, std::move(read), nullptr});
+    offsets.push_back(offsets.back() + tarBlockSize + paddedSize(size));
+}
+
+std::span<const char> TarStream::chunk(std::uint64_t offset, std::size_t length) const {
+    if (offset >= size()) return {};
+
+    const auto index = static_cast<std::size_t>(
+        std::ranges::upper_bound(offsets, offset) - offsets.begin() - 1);
+    auto rel = offset - offsets[index];
+    const auto view = [&](std::span<const char> part) {
+        return part.subspan(static_cast<std::size_t>(rel),
+                            std::min<std::uint64_t>(length, part.size() - rel));
+    };
+
+    if (index == entries.size()) return view(zeros);
+
+    const auto& entry = entries[index];
+    if (rel < tarBlockSize) return view(entry.header);
+    rel -= tarBlockSize;
+    if (rel < entry.size) return entry.read ? std::span<const char>{} : view(entry.data);
+    rel -= entry.size;
+    return view(std::span{zeros}.first(paddedSize(entry.size) - entry.size));
+}
+
+std::span<const char> TarStream::read(std::uint64_t offset, std::span<char> buffer) const {
+    if (offset >= size()) return {};
+
+    const auto index = static_cast<std::size_t>(
+        std::ranges::upper_bound(offsets, offset) - offsets.begin() - 1);
+    const auto rel = offset - offsets[index];
+    if (index < entries.size() && entries[index].read && rel >= tarBlockSize &&
+        rel - tarBlockSize < entries[index].size) {
+        const auto& entry = entries[index];
+        const auto pos = rel - tarBlockSize;
+        const auto length = std::min<std::uint64_t>(buffer.size(), entry.size - pos);
+        return buffer.first(entry.read(pos, buffer.first(static_cast<std::size_t>(length))));
+    }
+    return chunk(offset, buffer.size());
+}
+
+TarParser::TarParser(std::function<void(const TarEntry&)> begin,
+                     std::function<void(std::span<const char>)> data,
+                     std::function<void()> end)
+    : begin{std::move(begin)}, data{std::move(data)}, end{std::move(end)} {}
+
+void TarParser::feed(std::span<const char> input) {
+    while (!input.empty() && state != State::Done) {
+        if (padding > 0) {
+            const auto n = static_cast<std::size_t>(std::min<std::uint64_t>(padding, input.size()));
+            padding -= n;
+            input = input.subspan(n);
+        } else if (state == State::Header) {
+            const auto n = std::min(tarBlockSize - header.size(), input.size());
+            header.append(input.data(), n);
+            input = input.subspan(n);
+            if (header.size() == tarBlockSize) parseHeader();
+        } else {
+            const auto part = input.first(
+                static_cast<std::size_t>(std::min<std::uint64_t>(remaining, input.size())));
+            const auto n = part.size();
+            if (state == State::Content) {
+                data(part);
+            } else if (state == State::Pax || state == State::LongName) {
+                pax.append(part.data(), part.size());
+            }
+            remaining -= n;
+            input = input.subspan(n);
+            if (remaining == 0) finishEntry();
+        }
+    }
+}
+
+void TarParser::parseHeader() {
+    const auto block = std::exchange(header, {});
+    if (std::ranges::all_of(block, [](char c) { return c == '\0'; })) {
+        state = State::Done;
+        return;
+    }
+    const std::string_view view{block};
+
+    unsigned checksum = 0;
+    for (std::size_t i = 0; i < tarBlockSize; ++i) {
+        checksum += i >= 148 && i < 156 ? ' ' : static_cast<unsigned char>(view[i]);
+    }
+    if (getNumber(view.substr(148, 8)) != checksum) {
+        throw std::runtime_error("Invalid tar header checksum");
+    }
+
+    size = getNumber(view.substr(124, 12));
+    remaining = size;
+    const auto type = view[156];
+    if (type == '0' || type == '\0' || type == '7') {
+        auto name = std::string{getString(view.substr(0, 100))};
+        if (const auto prefix = getString(view.substr(345, 155));
+            view.substr(257, 5) == "ustar" && !prefix.empty()) {
+            name = fmt::format("{}/{}", prefix, name);
+        }
+        if (paxPath) name = *std::exchange(paxPath, std::nullopt);
+        if (paxSize) size = remaining = *std::exchange(paxSize, std::nullopt);
+        state = State::Content;
+        begin(TarEntry{.name = std::move(name), .size = size});
+    } else if (type == 'x' || type == 'L') {
+        constexpr std::uint64_t maxPaxSize = 1024 * 1024;
+        if (size > maxPaxSize) throw std::runtime_error("Tar pax header is too large");
+        pax.clear();
+        state = type == 'x' ? State::Pax : State::LongName;
+    } else {
+        state = State::Skip;
+    }
+    if (remaining == 0) finishEntry();
+}
+
+void TarParser::finishEntry() {
+    padding = paddedSize(size) - size;
+    if (state == State::Content) {
+        end();
+    } else if (state == State::Pax) {
+        // Records of the form "<length> <key>=<value>\n", the length includes the whole record
+        std::string_view records{pax};
+        while (!records.empty()) {
+            const auto space = records.find(' ');
+            std::size_t length = 0;
+            if (space == records.npos ||
+                std::from_chars(records.data(), records.data() + space, length).ec != std::errc{} ||
+                length <= space + 1 || length > records.size()) {
+                throw std::runtime_error("Invalid tar pax header");
+            }
+            const auto [key, value] =
+                fp::splitByFirst(records.substr(space + 1, length - space - 2), '=');
+            if (key == "path") {
+                paxPath = std::string{value};
+            } else if (key == "size") {
+                paxSize = fp::strToNum<std::uint64_t>(value);
+            }
+            records.remove_prefix(length);
+        }
+    } else if (state == State::LongName) {
+        // GNU tar stores the name null terminated, a pax path of the same entry takes precedence
+        if (!paxPath) paxPath = pax.substr(0, pax.find('\0'));
+    }
+    state = State::Header;
+}
+
+}  // namespace vcache
@@ -0,0 +1,289 @@
+#include <vcpkg-cache-server/zip.hpp>
+
+#include <fmt/format.h>
+#include <fmt/std.h>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace vcache {
+
+namespace {
+
+constexpr std::uint32_t localHeaderSig = 0x04034b50;
+constexpr std::uint32_t centralHeaderSig = 0x02014b50;
+constexpr std::uint32_t endOfDirSig = 0x06054b50;
+constexpr std::uint32_t zip64EndOfDirSig = 0x06064b50;
+constexpr std::uint32_t zip64LocatorSig = 0x07064b50;
+
+constexpr std::size_t localHeaderSize = 30;
+constexpr std::size_t centralHeaderSize = 46;
+constexpr std::size_t endOfDirSize = 22;
+constexpr std::size_t zip64EndOfDirSize = 56;
+constexpr std::size_t zip64LocatorSize = 20;
+constexpr std::size_t maxCommentSize = 0xffff;
+
+constexpr std::uint16_t zip64ExtraId = 0x0001;
+constexpr std::uint16_t methodStored = 0;
+constexpr std::uint16_t methodDeflated = 8;
+constexpr std::uint16_t flagEncrypted = 0x1;
+
+/* Bounds checked little endian access to the file. Offsets are relative to the start of the
+ * file, data holds the bytes of the file starting at base.
+ */
+class Bytes {
+public:
+    explicit Bytes(std::span<const char> data) : data{data}, total{data.size()} {}
+    Bytes(std::span<const char> data, std::uint64_t base, std::uint64_t total)
+        : data{data}, base{base}, total{total} {}
+
+    template <typename T>
+    T get(std::uint64_t offset) const {
+        check(offset, sizeof(T));
+        T value = 0;
+        for (std::size_t i = 0; i < sizeof(T); ++i) {
+            value |= static_cast<T>(static_cast<unsigned char>(data[offset - base + i]))
+                     << (8 * i);
+        }
+        return value;
+    }
+
+    std::string_view str(std::uint64_t offset, std::uint64_t size) const {
+        check(offset, size);
+        return {data.data() + (offset - base), static_cast<std::size_t>(size)};
+    }
+
+    /* The size of the whole file */
+    std::uint64_t size() const { return total; }
+
+private:
+    void check(std::uint64_t offset, std::uint64_t size) const {
+        if (offset < base || offset - base > data.size() || size > data.size() - (offset - base)) {
+            throw std::runtime_error("Zip file is truncated");
+        }
+    }
+    std::span<const char> data;
+    std::uint64_t base = 0;
+    std::uint64_t total = 0;
+};
+
+std::uint64_t findEndOfDir(const Bytes& bytes) {
+    if (bytes.size() < endOfDirSize) {
+        throw std::runtime_error("Zip file is too small");
+    }
+    // The end of central directory record is followed by a variable size comment
+    const auto last = bytes.size() - endOfDirSize;
+    const auto first = last > maxCommentSize ? last - maxCommentSize : 0;
+    for (auto offset = last + 1; offset-- > first;) {
+        if (bytes.get<std::uint32_t>(offset) == endOfDirSig &&
+            offset + endOfDirSize + bytes.get<std::uint16_t>(offset + 20) == bytes.size()) {
+            return offset;
+        }
+    }
+    throw std::runtime_error("Zip end of central directory not found");
+}
+
+template <typename Pred>
+std::optional<ZipEntry> walk(const Bytes& bytes, std::uint64_t offset, std::uint64_t count,
+                             Pred&& pred) {
+    for (std::uint64_t i = 0; i < count; ++i) {
+        if (bytes.get<std::uint32_t>(offset) != centralHeaderSig) {
+            throw std::runtime_error("Invalid zip central directory header");
+        }
+        const auto nameSize = bytes.get<std::uint16_t>(offset + 28);
+        const auto extraSize = bytes.get<std::uint16_t>(offset + 30);
+        const auto commentSize = bytes.get<std::uint16_t>(offset + 32);
+        const auto name = bytes.str(offset + centralHeaderSize, nameSize);
+
+        if (pred(name)) {
+            ZipEntry entry{.name = name,
+                           .method = bytes.get<std::uint16_t>(offset + 10),
+                           .flags = bytes.get<std::uint16_t>(offset + 8),
+                           .crc = bytes.get<std::uint32_t>(offset + 16),
+                           .compressedSize = bytes.get<std::uint32_t>(offset + 20),
+                           .size = bytes.get<std::uint32_t>(offset + 24),
+                           .localOffset = bytes.get<std::uint32_t>(offset + 42)};
+
+            // Values that do not fit are stored in the zip64 extra field, in this order
+            constexpr auto max32 = std::numeric_limits<std::uint32_t>::max();
+            auto extra = offset + centralHeaderSize + nameSize;
+            const auto extraEnd = extra + extraSize;
+            while (extra + 4 <= extraEnd) {
+                const auto id = bytes.get<std::uint16_t>(extra);
+                const auto size = bytes.get<std::uint16_t>(extra + 2);
+                if (id == zip64ExtraId) {
+                    auto field = extra + 4;
+                    for (auto* value : {&entry.size, &entry.compressedSize, &entry.localOffset}) {
+                        if (*value == max32 && field + 8 <= extra + 4 + size) {
+                            *value = bytes.get<std::uint64_t>(field);
+                            field += 8;
+                        }
+                    }
+                }
+                extra += 4 + size;
+            }
+            return entry;
+        }
+        offset += centralHeaderSize + nameSize + extraSize + commentSize;
+    }
+    return std::nullopt;
+}
+
+std::string inflate(std::string_view input, std::uint64_t size) {
+    std::string out(static_cast<std::size_t>(size), '\0');
+    z_stream stream{};
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+        throw std::runtime_error("Unable to initialize zlib");
+    }
+    // Large entries are inflated in chunks, the avail fields of zlib are 32 bit
+    constexpr std::size_t chunk = std::numeric_limits<uInt>::max();
+    std::size_t in = 0;
+    std::size_t written = 0;
+    int res = Z_OK;
+    while (res == Z_OK) {
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data() + in));
+        stream.avail_in = static_cast<uInt>(std::min(chunk, input.size() - in));
+        stream.next_out = reinterpret_cast<Bytef*>(out.data() + written);
+        stream.avail_out = static_cast<uInt>(std::min(chunk, out.size() - written));
+        const auto availIn = stream.avail_in;
+        const auto availOut = stream.avail_out;
+        res = ::inflate(&stream, Z_NO_FLUSH);
+        in += availIn - stream.avail_in;
+        written += availOut - stream.avail_out;
+        if (res == Z_OK && availIn == stream.avail_in && availOut == stream.avail_out) {
+            res = Z_BUF_ERROR;
+        }
+    }
+    inflateEnd(&stream);
+    if (res != Z_STREAM_END || written != out.size()) {
+        throw std::runtime_error("Unable to inflate zip entry");
+    }
+    return out;
+}
+
+}  // namespace
+
+ZipReader::ZipReader(const std::filesystem::path& path, bool map) {
+    try {
+        std::string tail;
+        const auto bytes = [&]() {
+            if (map) {
+                mapped.emplace(path);
+                fileSize = mapped->size();
+                return Bytes{mapped->data()};
+            }
+            file.open(path, std::ios_base::in | std::ios_base::binary);
+            if (!file) throw std::runtime_error("Unable to open file");
+            fileSize = std::filesystem::file_size(path);
+            // The end records of the file, including the largest possible comment
+            constexpr std::uint64_t tailSize =
+                endOfDirSize + maxCommentSize + zip64LocatorSize + zip64EndOfDirSize;
+            const auto offset = fileSize - std::min(fileSize, tailSize);
+            return Bytes{part(offset, fileSize - offset, tail), offset, fileSize};
+        }();
+
+        const auto end = findEndOfDir(bytes);
+        if (bytes.get<std::uint16_t>(end + 4) != bytes.get<std::uint16_t>(end + 6)) {
+            throw std::runtime_error("Multi disk zip files are not supported");
+        }
+        count = bytes.get<std::uint16_t>(end + 10);
+        directorySize = bytes.get<std::uint32_t>(end + 12);
+        directoryOffset = bytes.get<std::uint32_t>(end + 16);
+
+        if (end >= zip64LocatorSize &&
+            bytes.get<std::uint32_t>(end - zip64LocatorSize) == zip64LocatorSig) {
+            const auto end64 = bytes.get<std::uint64_t>(end - zip64LocatorSize + 8);
+            if (bytes.get<std::uint32_t>(end64) != zip64EndOfDirSig ||
+                end64 + zip64EndOfDirSize > bytes.size()) {
+                throw std::runtime_error("Invalid zip64 end of central directory");
+            }
+            count = bytes.get<std::uint64_t>(end64 + 32);
+            directorySize = bytes.get<std::uint64_t>(end64 + 40);
+            directoryOffset = bytes.get<std::uint64_t>(end64 + 48);
+        }
+        if (directoryOffset > fileSize) {
+            throw std::runtime_error("Zip file is truncated");
+        }
+        if (map) {
+            view = mapped->data();
+        } else {
+            view = part(directoryOffset, fileSize - directoryOffset, directory);
+            viewOffset = directoryOffset;
+        }
+        // Validates the range of the directory
+        Bytes{view, viewOffset, fileSize}.str(directoryOffset, directorySize);
+        if (count > directorySize / centralHeaderSize) {
+            throw std::runtime_error("Invalid zip central directory size");
+        }
+    } catch (const std::exception& e) {
+        throw std::runtime_error(fmt::format("Unable to read zip file {}: {}", path, e.what()));
+    }
+}
+
+std::string_view ZipReader::part(std::uint64_t offset, std::uint64_t size,
+                                 std::string& buffer) const {
+    buffer.resize(static_cast<std::size_t>(std::min(size, fileSize - std::min(offset, fileSize))));
+    file.clear();
+    file.seekg(static_cast<std::streamoff>(offset));
+    file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    buffer.resize(static_cast<std::size_t>(std::max(std::streamsize{0}, file.gcount())));
+    return buffer;
+}
+
+std::optional<ZipEntry> ZipReader::find(std::string_view name) const {
+    return walk(Bytes{view, viewOffset, fileSize}, directoryOffset, count,
+                [&](std::string_view item) { return item == name; });
+}
+
+std::optional<ZipEntry> ZipReader::findIf(
+    const std::function<bool(std::string_view)>& pred) const {
+    return walk(Bytes{view, viewOffset, fileSize}, directoryOffset, count, pred);
+}
+
+std::string ZipReader::read(const ZipEntry& entry) const {
+    if (entry.flags & flagEncrypted) {
+        throw std::runtime_error(fmt::format("Zip entry {} is encrypted", entry.name));
+    }
+    std::string header;
+    const auto headerBytes =
+        mapped ? Bytes{mapped->data()}
+               : Bytes{part(entry.localOffset, localHeaderSize, header), entry.localOffset,
+                       fileSize};
+    if (headerBytes.get<std::uint32_t>(entry.localOffset) != localHeaderSig) {
+        throw std::runtime_error(fmt::format("Invalid zip local header of {}", entry.name));
+    }
+    // The local header has its own name and extra field sizes
+    const auto dataOffset = entry.localOffset + localHeaderSize +
+                            headerBytes.get<std::uint16_t>(entry.localOffset + 26) +
+                            headerBytes.get<std::uint16_t>(entry.localOffset + 28);
+    std::string data;
+    const auto bytes =
+        mapped ? Bytes{mapped->data()}
+               : Bytes{part(dataOffset, entry.compressedSize, data), dataOffset, fileSize};
+    const auto input = bytes.str(dataOffset, entry.compressedSize);
+
+    auto out = [&]() {
+        if (entry.method == methodStored) {
+            if (entry.compressedSize != entry.size) {
+                throw std::runtime_error(fmt::format("Invalid size of zip entry {}", entry.name));
+            }
+            return std::string{input};
+        } else if (entry.method == methodDeflated) {
+            return inflate(input, entry.size);
+        } else {
+            throw std::runtime_error(fmt::format("Unsupported compression method {} of {}",
+                                                 entry.method, entry.name));
+        }
+    }();
+
+    const auto crc = crc32_z(0, reinterpret_cast<const Bytef*>(out.data()), out.size());
+    if (crc != entry.crc) {
+        throw std::runtime_error(fmt::format("Crc missmatch of zip entry {}", entry.name));
+    }
+    return out;
+}
+
+}  // namespace vcache
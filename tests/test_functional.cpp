@@ -3,12 +3,17 @@
 
 #include <vcpkg-cache-server/functional.hpp>
 
+#include "test_utils.hpp"
+
+#include <ctime>
+#include <fstream>
 #include <map>
 #include <string>
 #include <vector>
 
 using namespace vcache;
 using namespace vcache::fp;
+using namespace vcache::test;
 
 // ============================================================================
 // splitByFirst
@@ -368,3 +373,175 @@ TEST_CASE("parseAuthHeader splits scheme and token", "[functional]") {
         CHECK(token == "");
     }
 }
+
+// ============================================================================
+// matchesETag - conditional request headers
+// ============================================================================
+
+TEST_CASE("matchesETag compares entity tag lists", "[functional]") {
+    SECTION("single tag") {
+        CHECK(matchesETag(R"("abc")", R"("abc")"));
+        CHECK_FALSE(matchesETag(R"("abd")", R"("abc")"));
+        CHECK_FALSE(matchesETag("abc", R"("abc")"));
+    }
+    SECTION("list of tags") {
+        CHECK(matchesETag(R"("x", "abc" ,"y")", R"("abc")"));
+        CHECK_FALSE(matchesETag(R"("x", "y")", R"("abc")"));
+    }
+    SECTION("wildcard") {
+        CHECK(matchesETag("*", R"("abc")"));
+        CHECK(matchesETag(" * ", R"("abc")", false));
+    }
+    SECTION("weak tags only match with weak comparison") {
+        CHECK(matchesETag(R"(W/"abc")", R"("abc")"));
+        CHECK_FALSE(matchesETag(R"(W/"abc")", R"("abc")", false));
+        CHECK(matchesETag(R"(W/"abc", "abc")", R"("abc")", false));
+    }
+    SECTION("empty header") {
+        CHECK_FALSE(matchesETag("", R"("abc")"));
+    }
+}
+
+// ============================================================================
+// LruCache - bounded least recently used cache
+// ============================================================================
+
+TEST_CASE("LruCache evicts the least recently used item", "[functional]") {
+    LruCache<int> cache{2};
+    cache.put("a", 1);
+    cache.put("b", 2);
+    CHECK(cache.get("a") == 1);
+
+    cache.put("c", 3);
+    CHECK(cache.size() == 2);
+    CHECK(cache.get("b") == std::nullopt);
+    CHECK(cache.get("a") == 1);
+    CHECK(cache.get("c") == 3);
+
+    SECTION("put replaces existing values") {
+        cache.put("a", 10);
+        CHECK(cache.size() == 2);
+        CHECK(cache.get("a") == 10);
+    }
+    SECTION("erase removes items") {
+        cache.erase("a");
+        cache.erase("missing");
+        CHECK(cache.size() == 1);
+        CHECK(cache.get("a") == std::nullopt);
+    }
+}
+
+TEST_CASE("LruCache with zero capacity stores nothing", "[functional]") {
+    LruCache<int> cache{0};
+    cache.put("a", 1);
+    CHECK(cache.size() == 0);
+    CHECK(cache.get("a") == std::nullopt);
+}
+
+// ============================================================================
+// OutputFile - buffered file writer
+// ============================================================================
+
+TEST_CASE("OutputFile writes through its buffer", "[functional]") {
+    for (const bool direct : {false, true}) {
+        TempDir dir;
+        const auto path = dir.path / "file.bin";
+
+        std::string content;
+        OutputFile file{path, 50'000, 10'000, direct};
+        REQUIRE(file.isOpen());
+        // Small writes collect in the buffer, the buffer is rounded up to whole blocks
+        file.write(std::string(1000, 'a'));
+        content += std::string(1000, 'a');
+        CHECK(file.size() == 1000);
+        CHECK(std::filesystem::file_size(path) == 0);
+
+        // Writes larger than the buffer and flushes reach the file
+        for (const char c : {'b', 'c', 'd'}) {
+            const std::string data(15'000, c);
+            file.write(data);
+            content += data;
+        }
+        const auto flushed = file.flush();
+        CHECK(std::filesystem::file_size(path) == flushed);
+        CHECK(flushed <= content.size());
+        if (!direct) CHECK(flushed == content.size());
+
+        file.close();
+        CHECK_FALSE(file.isOpen());
+        CHECK(readFile(path) == content);
+    }
+}
+
+TEST_CASE("OutputFile appends to an existing file", "[functional]") {
+    TempDir dir;
+    const auto path = dir.path / "file.bin";
+    std::ofstream{path, std::ios_base::binary} << "first";
+
+    // Direct I/O is ignored, the end of the file is not aligned
+    OutputFile file{path, std::nullopt, 10'000, true, true};
+    CHECK(file.size() == 5);
+    file.write(std::string_view{"second"});
+    file.close();
+    CHECK(readFile(path) == "firstsecond");
+
+    // A missing file is created
+    OutputFile created{dir.path / "new.bin", std::nullopt, 10'000, false, true};
+    created.write(std::string_view{"new"});
+    created.close();
+    CHECK(readFile(dir.path / "new.bin") == "new");
+}
+
+TEST_CASE("syncAll reports the paths it could not flush", "[functional]") {
+    TempDir dir;
+    std::ofstream{dir.path / "a"} << "a";
+    std::ofstream{dir.path / "b"} << "b";
+    const std::vector<std::filesystem::path> paths{dir.path / "a", dir.path / "missing",
+                                                   dir.path / "b", dir.path};
+    const auto errors = syncAll(paths);
+    REQUIRE(errors.size() == paths.size());
+    CHECK(errors[0] == nullptr);
+    CHECK(errors[1] != nullptr);
+    CHECK(errors[2] == nullptr);
+    CHECK(errors[3] == nullptr);
+}
+
+TEST_CASE("isLocalFileSystem accepts the temporary directory", "[functional]") {
+    TempDir dir;
+    CHECK(isLocalFileSystem(dir.path));
+}
+
+// Run with: vcpkg-cache-server-tests "[benchmark]"
+TEST_CASE("OutputFile CPU time per GB compared to std::ofstream", "[.][benchmark]") {
+    constexpr size_t total = size_t{2} << 30;
+    TempDir dir;
+    const auto path = dir.path / "upload.bin";
+
+    // Process CPU time, including the time spent in the kernel copying into the page cache
+    const auto cpuPerGB = [&](size_t chunk, const auto& write) {
+        const std::string data(chunk, 'x');
+        const auto start = std::clock();
+        write(data, total / chunk);
+        const auto seconds = static_cast<double>(std::clock() - start) / CLOCKS_PER_SEC;
+        std::filesystem::remove(path);
+        return seconds / static_cast<double>(total >> 30);
+    };
+    const auto stream = [&](const std::string& data, size_t count) {
+        std::ofstream file{path, std::ios_base::binary};
+        for (size_t i = 0; i < count; ++i) file.write(data.data(), data.size());
+    };
+    const auto output = [&](bool direct) {
+        return [&, direct](const std::string& data, size_t count) {
+            OutputFile file{path, total, 4'000'000, direct};
+            for (size_t i = 0; i < count; ++i) file.write(data);
+            file.close();
+        };
+    };
+
+    for (const size_t chunk : {size_t{4} << 10, size_t{16} << 10, size_t{64} << 10}) {
+        WARN(fmt::format("{:>2} KiB chunks: std::ofstream {:.3f} s/GB, OutputFile {:.3f} s/GB, "
+                         "direct {:.3f} s/GB",
+                         chunk >> 10, cpuPerGB(chunk, stream), cpuPerGB(chunk, output(false)),
+                         cpuPerGB(chunk, output(true))));
+    }
+}
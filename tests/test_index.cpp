@@ -0,0 +1,165 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <vcpkg-cache-server/index.hpp>
+#include <vcpkg-cache-server/store.hpp>
+
+#include "test_utils.hpp"
+
+#include <fmt/format.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace vcache;
+using namespace vcache::test;
+
+namespace {
+
+Info testInfo(size_t i) {
+    return {.package = fmt::format("package-{}", i % 3),
+            .version = "1.0.0",
+            .arch = "x64-linux",
+            .sha = testKey(i),
+            .time = Time{Duration{1'700'000'000 + static_cast<Rep>(i)}},
+            .size = 1000 + i};
+}
+
+bool sameInfo(const Info& a, const Info& b) {
+    return a.package == b.package && a.version == b.version && a.arch == b.arch &&
+           a.sha == b.sha && a.time == b.time && a.size == b.size;
+}
+
+}  // namespace
+
+// ============================================================================
+// encodeIndex / decodeIndex
+// ============================================================================
+
+TEST_CASE("Index round trips infos", "[index]") {
+    std::vector<Info> infos;
+    for (size_t i = 0; i < 20; ++i) {
+        infos.push_back(testInfo(i));
+    }
+    std::vector<const Info*> ptrs;
+    for (const auto& info : infos) {
+        ptrs.push_back(&info);
+    }
+
+    const auto data = encodeIndex(ptrs);
+    const auto decoded = decodeIndex(data);
+
+    REQUIRE(decoded.size() == infos.size());
+    for (size_t i = 0; i < infos.size(); ++i) {
+        CHECK(sameInfo(decoded[i], infos[i]));
+    }
+}
+
+TEST_CASE("Index of no infos is valid", "[index]") {
+    const auto data = encodeIndex({});
+    CHECK(decodeIndex(data).empty());
+}
+
+TEST_CASE("Index deduplicates strings", "[index]") {
+    std::vector<Info> infos(100, testInfo(1));
+    std::vector<const Info*> ptrs;
+    for (const auto& info : infos) {
+        ptrs.push_back(&info);
+    }
+    const auto one = encodeIndex(std::span{ptrs}.first(1));
+    const auto all = encodeIndex(ptrs);
+
+    // Only the fixed size records should grow, not the string table
+    CHECK(all.size() - one.size() == 99 * 72);
+}
+
+TEST_CASE("decodeIndex rejects invalid data", "[index]") {
+    const auto info = testInfo(1);
+    const std::vector<const Info*> ptrs{&info};
+    const auto data = encodeIndex(ptrs);
+
+    SECTION("truncated") {
+        CHECK_THROWS(decodeIndex(std::span{data}.first(data.size() - 1)));
+        CHECK_THROWS(decodeIndex(std::span{data}.first(10)));
+    }
+    SECTION("bad magic") {
+        auto bad = data;
+        bad[0] = 'X';
+        CHECK_THROWS(decodeIndex(bad));
+    }
+    SECTION("bad version") {
+        auto bad = data;
+        bad[8] = 42;
+        CHECK_THROWS(decodeIndex(bad));
+    }
+}
+
+TEST_CASE("writeIndex and readIndex round trip through a file", "[index]") {
+    TempDir dir;
+    const auto info = testInfo(7);
+    const std::vector<const Info*> ptrs{&info};
+
+    writeIndex(dir.path / "index", encodeIndex(ptrs));
+    // Mapped and read like on a network file system
+    for (const bool map : {true, false}) {
+        const auto infos = readIndex(dir.path / "index", map);
+        REQUIRE(infos.size() == 1);
+        CHECK(sameInfo(infos.front(), info));
+    }
+    CHECK_FALSE(std::filesystem::exists(dir.path / "index.tmp"));
+    CHECK_THROWS(readIndex(dir.path / "missing", false));
+}
+
+// ============================================================================
+// Store restarts
+// ============================================================================
+
+TEST_CASE("Store writes an index and reuses it on restart", "[index][store]") {
+    TempDir dir;
+    for (size_t i = 0; i < 10; ++i) {
+        makeCache(dir.path, testSha(i), "zlib");
+    }
+
+    {
+        Store store{dir.path, Storage{}, testLogger()};
+        REQUIRE(store.waitForScan());
+        CHECK(std::ranges::distance(store.allInfos()) == 10);
+    }
+    REQUIRE(std::filesystem::exists(dir.path / ".vcache.index"));
+
+    // Overwrite a cache with garbage of the same size and modification time, if the index is used
+    // the file will not be opened again and the entry is kept.
+    const auto unchanged = dir.path / testSha(3).substr(0, 2) / fmt::format("{}.zip", testSha(3));
+    const auto size = std::filesystem::file_size(unchanged);
+    const auto time = std::filesystem::last_write_time(unchanged);
+    std::ofstream{unchanged, std::ios_base::binary} << std::string(size, 'x');
+    std::filesystem::last_write_time(unchanged, time);
+
+    // Changed files are extracted again
+    const auto changed = makeCache(dir.path, testSha(5), "bzip2", "2.0.0");
+    std::filesystem::last_write_time(changed, time + std::chrono::seconds{10});
+
+    // New files are extracted
+    makeCache(dir.path, testSha(20), "curl");
+
+    Store store{dir.path, Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+    CHECK(std::ranges::distance(store.allInfos()) == 11);
+    REQUIRE(store.info(testKey(3)) != nullptr);
+    CHECK(store.info(testKey(3))->package == "zlib");
+    REQUIRE(store.info(testKey(5)) != nullptr);
+    CHECK(store.info(testKey(5))->package == "bzip2");
+    REQUIRE(store.info(testKey(20)) != nullptr);
+    CHECK(store.info(testKey(20))->package == "curl");
+}
+
+TEST_CASE("Store ignores a corrupt index", "[index][store]") {
+    TempDir dir;
+    makeCache(dir.path, testSha(1), "zlib");
+    std::ofstream{dir.path / ".vcache.index", std::ios_base::binary} << "garbage";
+
+    Store store{dir.path, Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+    CHECK(std::ranges::distance(store.allInfos()) == 1);
+}
@@ -0,0 +1,77 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <vcpkg-cache-server/intern.hpp>
+
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace vcache;
+
+// ============================================================================
+// StringPool
+// ============================================================================
+
+TEST_CASE("StringPool deduplicates strings", "[intern]") {
+    StringPool pool;
+    const std::string a = "cmake";
+    const std::string b = "cmake";
+
+    const auto va = pool.intern(a);
+    const auto vb = pool.intern(b);
+    CHECK(va == "cmake");
+    CHECK(va.data() == vb.data());
+    CHECK(va.data() != a.data());
+    CHECK(pool.intern("compiler").data() != va.data());
+    CHECK(pool.size() == 2);
+    CHECK(pool.bytes() == ByteSize{13});
+}
+
+TEST_CASE("StringPool is thread safe", "[intern]") {
+    StringPool pool;
+    std::vector<std::jthread> threads;
+    for (size_t t = 0; t < 8; ++t) {
+        threads.emplace_back([&]() {
+            for (size_t i = 0; i < 1000; ++i) {
+                pool.intern(std::to_string(i));
+            }
+        });
+    }
+    threads.clear();
+    CHECK(pool.size() == 1000);
+    CHECK(pool.intern("42").data() == pool.intern(std::string{"42"}).data());
+}
+
+// ============================================================================
+// StringMap
+// ============================================================================
+
+TEST_CASE("StringMap is sorted by key", "[intern]") {
+    StringPool pool;
+    const std::map<std::string, std::string> source{{"triplet", "x64-linux"}, {"cmake", "3.30.1"}};
+    const StringMap map{source, pool};
+
+    REQUIRE(map.size() == 2);
+    CHECK(map.begin()->first == "cmake");
+    CHECK(fp::mGet(map, "triplet") == "x64-linux");
+    CHECK(fp::mGet(map, "compiler") == std::nullopt);
+    CHECK(map.find("cmake")->second.data() == pool.intern("3.30.1").data());
+}
+
+TEST_CASE("StringMap keeps the first of duplicate keys", "[intern]") {
+    const StringMap map{{"b", "1"}, {"a", "2"}, {"b", "3"}};
+    REQUIRE(map.size() == 2);
+    CHECK(fp::mGet(map, "a") == "2");
+    CHECK(fp::mGet(map, "b") == "1");
+}
+
+TEST_CASE("StringMap compares by content", "[intern]") {
+    StringPool pool;
+    const StringMap a{{{"k1", "v1"}, {"k2", "v2"}}, pool};
+    const StringMap b{{"k2", "v2"}, {"k1", "v1"}};
+    const StringMap c{{"k1", "v1"}};
+    CHECK(a == b);
+    CHECK_FALSE(a == c);
+    CHECK(StringMap{}.empty());
+}
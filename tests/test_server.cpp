@@ -0,0 +1,465 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <vcpkg-cache-server/server.hpp>
+#include <vcpkg-cache-server/tar.hpp>
+
+#include "test_utils.hpp"
+
+#include <httplib.h>
+
+#include <fmt/format.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <span>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+using namespace vcache;
+using namespace vcache::test;
+
+namespace {
+
+// Serves the cache routes of a store on a local port
+struct TestServer {
+    explicit TestServer(Store& store) : service{store, db, dbMutex, auth, testLogger()} {
+        auth.write.emplace(token, "tester");
+        setExpectContinueHandler(server, service);
+        addDownloadRoute(server, service);
+        addUploadRoutes(server, service, staging);
+        addExistsRoute(server, service);
+        addBundleRoute(server, service);
+        addBatchRoute(server, service);
+        port = server.bind_to_any_port("127.0.0.1");
+        thread = std::jthread{[this]() { server.listen_after_bind(); }};
+        server.wait_until_ready();
+    }
+    ~TestServer() { server.stop(); }
+
+    httplib::Client client() const { return httplib::Client{"127.0.0.1", port}; }
+
+    static constexpr std::string_view token = "secret";
+
+    db::Database db = db::create(":memory:");
+    std::mutex dbMutex;
+    Authorization auth;
+    CacheService service;
+    TempDir stagingDir;
+    Staging staging{stagingDir.path, std::chrono::hours{1}, testLogger()};
+    httplib::Server server;
+    int port = 0;
+    std::jthread thread;
+};
+
+std::string cachePath(size_t i) { return fmt::format("/cache/{}", testSha(i)); }
+
+const httplib::Headers authorized{{"Authorization", fmt::format("Bearer {}", TestServer::token)}};
+
+httplib::Headers withOffset(size_t offset) {
+    auto headers = authorized;
+    headers.emplace("Upload-Offset", std::to_string(offset));
+    return headers;
+}
+
+httplib::Request makeRequest(std::string method, std::string path, std::string_view token) {
+    httplib::Request req;
+    req.method = std::move(method);
+    req.path = std::move(path);
+    if (!token.empty()) req.set_header("Authorization", fmt::format("Bearer {}", token));
+    return req;
+}
+
+}  // namespace
+
+// ============================================================================
+// Expect: 100-continue
+// ============================================================================
+
+TEST_CASE("Expect: 100-continue refuses uploads before the body is sent", "[server]") {
+    TempDir dir;
+    makeCache(dir.path, testSha(14), "zlib");
+    Store store{dir.path, Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+    TestServer server{store};
+
+    const auto expect = [&](std::string method, std::string path, std::string_view token) {
+        const auto req = makeRequest(std::move(method), std::move(path), token);
+        httplib::Response res;
+        return expectContinue(server.service, req, res);
+    };
+
+    CHECK(expect("PUT", cachePath(15), TestServer::token) == httplib::StatusCode::Continue_100);
+    CHECK(expect("PUT", cachePath(14), TestServer::token) == httplib::StatusCode::Conflict_409);
+    CHECK(expect("PUT", cachePath(15), "") == httplib::StatusCode::Unauthorized_401);
+    CHECK(expect("PUT", cachePath(15), "wrong") == httplib::StatusCode::Forbidden_403);
+    CHECK(expect("POST", "/cache/batch", "") == httplib::StatusCode::Unauthorized_401);
+    CHECK(expect("PATCH", "/upload/0123", "wrong") == httplib::StatusCode::Forbidden_403);
+    // Other requests need no authorization
+    CHECK(expect("POST", "/cache/exists", "") == httplib::StatusCode::Continue_100);
+}
+
+// ============================================================================
+// HEAD /cache/<sha>
+// ============================================================================
+
+TEST_CASE("HEAD of a cache sends its headers without the body", "[server]") {
+    TempDir dir;
+    const auto path = makeCache(dir.path, testSha(1), "zlib", "1.3.1");
+    Store store{dir.path, Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+
+    TestServer server{store};
+    const auto res = server.client().Head(cachePath(1));
+    REQUIRE(res);
+    CHECK(res->status == httplib::StatusCode::OK_200);
+    CHECK(res->get_header_value("Content-Length") ==
+          std::to_string(std::filesystem::file_size(path)));
+    const auto etag = res->get_header_value("ETag");
+    CHECK(etag.starts_with(fmt::format("\"{}-", testSha(1))));
+    CHECK(res->get_header_value("X-Vcpkg-Package") == "zlib");
+    CHECK(res->body.empty());
+    CHECK(server.db.count<db::Download>() == 0);
+
+    // A conditional HEAD is answered like a conditional GET
+    const auto cached = server.client().Head(cachePath(1), {{"If-None-Match", etag}});
+    REQUIRE(cached);
+    CHECK(cached->status == httplib::StatusCode::NotModified_304);
+}
+
+TEST_CASE("HEAD of a missing cache is not found", "[server]") {
+    TempDir dir;
+    Store store{dir.path, Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+
+    TestServer server{store};
+    const auto res = server.client().Head(cachePath(2));
+    REQUIRE(res);
+    CHECK(res->status == httplib::StatusCode::NotFound_404);
+    CHECK(server.db.count<db::Download>() == 0);
+
+    // After the scan files added behind the back of the store are not looked up
+    makeCache(dir.path, testSha(3), "curl");
+    const auto added = server.client().Head(cachePath(3));
+    REQUIRE(added);
+    CHECK(added->status == httplib::StatusCode::NotFound_404);
+}
+
+TEST_CASE("HEAD of a cache that is being uploaded announces its size", "[server]") {
+    TempDir dir;
+    Store store{dir.path, Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+    TestServer server{store};
+
+    auto sized = store.write(testKey(6), 1234);
+    REQUIRE(sized);
+    const auto res = server.client().Head(cachePath(6));
+    REQUIRE(res);
+    CHECK(res->status == httplib::StatusCode::OK_200);
+    CHECK(res->get_header_value("Content-Length") == "1234");
+
+    auto unsized = store.write(testKey(7));
+    REQUIRE(unsized);
+    const auto chunked = server.client().Head(cachePath(7));
+    REQUIRE(chunked);
+    CHECK(chunked->status == httplib::StatusCode::OK_200);
+    CHECK(chunked->get_header_value("Transfer-Encoding") == "chunked");
+    CHECK(server.db.count<db::Download>() == 0);
+}
+
+// ============================================================================
+// GET /cache/<sha>
+// ============================================================================
+
+TEST_CASE("GET sends the whole cache when If-Range does not match", "[server]") {
+    TempDir dir;
+    const auto path = makeCache(dir.path, testSha(5), "zlib");
+    const auto content = readFile(path);
+    Store store{dir.path, Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+
+    TestServer server{store};
+    const auto head = server.client().Head(cachePath(5));
+    REQUIRE(head);
+    const auto etag = head->get_header_value("ETag");
+
+    const auto matching =
+        server.client().Get(cachePath(5), {{"Range", "bytes=0-9"}, {"If-Range", etag}});
+    REQUIRE(matching);
+    CHECK(matching->status == httplib::StatusCode::PartialContent_206);
+    CHECK(matching->body == content.substr(0, 10));
+
+    const auto changed =
+        server.client().Get(cachePath(5), {{"Range", "bytes=0-9"}, {"If-Range", "\"other\""}});
+    REQUIRE(changed);
+    CHECK(changed->status == httplib::StatusCode::OK_200);
+    CHECK_FALSE(changed->has_header("Content-Range"));
+    CHECK(changed->body == content);
+
+    const auto several = server.client().Get(
+        cachePath(5), {{"Range", "bytes=0-9,20-29"}, {"If-Range", "\"other\""}});
+    REQUIRE(several);
+    CHECK(several->status == httplib::StatusCode::PreconditionFailed_412);
+}
+
+TEST_CASE("The entity tag changes when a removed cache is uploaded again", "[server]") {
+    TempDir dir;
+    const auto old = readFile(makeCache(dir.path / "source", testSha(18), "zlib", "1.0"));
+    const auto replaced = readFile(makeCache(dir.path / "other", testSha(18), "zlib", "1.0.1"));
+    REQUIRE(old.size() != replaced.size());
+    Store store{dir.path / "store", Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+    TestServer server{store};
+
+    const auto upload = [&](const std::string& content) {
+        auto writer = store.write(testKey(18));
+        REQUIRE(writer);
+        writer->write(content.data(), content.size());
+        writer->commit();
+    };
+    upload(old);
+    const auto first = server.client().Head(cachePath(18));
+    REQUIRE(first);
+    const auto etag = first->get_header_value("ETag");
+    CHECK(first->get_header_value("Cache-Control") == "public, no-cache");
+
+    store.remove(testKey(18));
+    upload(replaced);
+    const auto second = server.client().Get(cachePath(18), {{"If-None-Match", etag}});
+    REQUIRE(second);
+    CHECK(second->status == httplib::StatusCode::OK_200);
+    CHECK(second->get_header_value("ETag") != etag);
+    CHECK(second->body == replaced);
+}
+
+#ifndef _WIN32
+TEST_CASE("HEAD looks up caches on disk while the scan is running", "[server]") {
+    TempDir dir;
+    const auto path = makeCache(dir.path, testSha(4), "zlib");
+    // The scan starts by reading the index, a fifo keeps it waiting until it is opened for writing
+    const auto index = dir.path / ".vcache.index";
+    REQUIRE(::mkfifo(index.c_str(), 0600) == 0);
+
+    Store store{dir.path, Storage{}, testLogger()};
+    TestServer server{store};
+    const auto scanning = !store.scanStatus().done;
+    const auto res = server.client().Head(cachePath(4));
+
+    // An index that can not be read is ignored
+    std::ofstream{index} << "not an index";
+    REQUIRE(store.waitForScan());
+
+    CHECK(scanning);
+    REQUIRE(res);
+    CHECK(res->status == httplib::StatusCode::OK_200);
+    CHECK(res->get_header_value("Content-Length") ==
+          std::to_string(std::filesystem::file_size(path)));
+    CHECK(server.db.count<db::Download>() == 0);
+}
+#endif
+
+// ============================================================================
+// /upload
+// ============================================================================
+
+TEST_CASE("Resumable uploads are added to the store when finalized", "[server]") {
+    TempDir dir;
+    const auto content = readFile(makeCache(dir.path / "source", testSha(16), "zlib"));
+    Store store{dir.path / "store", Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+    TestServer server{store};
+    auto client = server.client();
+
+    const auto created =
+        client.Post(fmt::format("/upload/{}", testSha(16)), authorized, "", "text/plain");
+    REQUIRE(created);
+    REQUIRE(created->status == httplib::StatusCode::Created_201);
+    const auto location = created->get_header_value("Location");
+    CHECK(location == fmt::format("/upload/{}", created->body));
+
+    const auto half = content.size() / 2;
+    const auto first =
+        client.Patch(location, withOffset(0), content.substr(0, half), "application/octet-stream");
+    REQUIRE(first);
+    CHECK(first->status == httplib::StatusCode::NoContent_204);
+    CHECK(first->get_header_value("Upload-Offset") == std::to_string(half));
+
+    const auto offset = client.Get(location, authorized);
+    REQUIRE(offset);
+    CHECK(offset->body == std::to_string(half));
+
+    const auto second =
+        client.Patch(location, withOffset(half), content.substr(half), "application/octet-stream");
+    REQUIRE(second);
+    CHECK(second->status == httplib::StatusCode::NoContent_204);
+
+    const auto finalized = client.Post(location + "/finalize", authorized, "", "text/plain");
+    REQUIRE(finalized);
+    CHECK(finalized->status == httplib::StatusCode::Created_201);
+    const auto reader = store.read(testKey(16));
+    REQUIRE(reader);
+    CHECK(reader->size() == content.size());
+    CHECK(server.db.count<db::Cache>() == 1);
+
+    // The session ends with the upload, a cache that exists can not be uploaded again
+    const auto ended = client.Get(location, authorized);
+    REQUIRE(ended);
+    CHECK(ended->status == httplib::StatusCode::NotFound_404);
+    const auto again =
+        client.Post(fmt::format("/upload/{}", testSha(16)), authorized, "", "text/plain");
+    REQUIRE(again);
+    CHECK(again->status == httplib::StatusCode::Conflict_409);
+}
+
+TEST_CASE("Chunks of resumable uploads are only appended at the current offset", "[server]") {
+    TempDir dir;
+    Store store{dir.path, Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+    TestServer server{store};
+    auto client = server.client();
+
+    const auto created =
+        client.Post(fmt::format("/upload/{}", testSha(17)), authorized, "", "text/plain");
+    REQUIRE(created);
+    const auto location = created->get_header_value("Location");
+
+    const auto first = client.Patch(location, withOffset(0), "0123456789", "text/plain");
+    REQUIRE(first);
+    CHECK(first->status == httplib::StatusCode::NoContent_204);
+
+    // A chunk that was already received or that leaves a gap is refused with the offset to
+    // continue at
+    for (const size_t at : {0, 4, 20}) {
+        const auto mismatch = client.Patch(location, withOffset(at), "abcdef", "text/plain");
+        REQUIRE(mismatch);
+        CHECK(mismatch->status == httplib::StatusCode::Conflict_409);
+        CHECK(mismatch->get_header_value("Upload-Offset") == "10");
+    }
+    const auto missing = client.Patch(location, authorized, "abcdef", "text/plain");
+    REQUIRE(missing);
+    CHECK(missing->status == httplib::StatusCode::BadRequest_400);
+    const auto anonymous =
+        client.Patch(location, httplib::Headers{{"Upload-Offset", "10"}}, "abc", "text/plain");
+    REQUIRE(anonymous);
+    CHECK(anonymous->status == httplib::StatusCode::Unauthorized_401);
+
+    const auto offset = client.Get(location, authorized);
+    REQUIRE(offset);
+    CHECK(offset->body == "10");
+
+    const auto removed = client.Delete(location, authorized);
+    REQUIRE(removed);
+    CHECK(removed->status == httplib::StatusCode::NoContent_204);
+    const auto finalized = client.Post(location + "/finalize", authorized, "", "text/plain");
+    REQUIRE(finalized);
+    CHECK(finalized->status == httplib::StatusCode::NotFound_404);
+}
+
+// ============================================================================
+// POST /cache/exists
+// ============================================================================
+
+TEST_CASE("Exists lists the caches that exist in request order", "[server]") {
+    TempDir dir;
+    const auto first = makeCache(dir.path, testSha(8), "zlib");
+    const auto second = makeCache(dir.path, testSha(9), "curl");
+    Store store{dir.path, Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+    TestServer server{store};
+
+    const auto body = fmt::format("{}\n{},{}", testSha(9), testSha(10), testSha(8));
+    const auto res = server.client().Post("/cache/exists", body, "text/plain");
+    REQUIRE(res);
+    CHECK(res->status == httplib::StatusCode::OK_200);
+    CHECK(res->body == fmt::format("{} {}\n{} {}\n", testSha(9), std::filesystem::file_size(second),
+                                   testSha(8), std::filesystem::file_size(first)));
+
+    const auto invalid = server.client().Post("/cache/exists", "abc", "text/plain");
+    REQUIRE(invalid);
+    CHECK(invalid->status == httplib::StatusCode::BadRequest_400);
+}
+
+// ============================================================================
+// POST /cache/bundle
+// ============================================================================
+
+TEST_CASE("Bundle streams the existing caches as a tar of <sha>.zip files", "[server]") {
+    TempDir dir;
+    const auto first = readFile(makeCache(dir.path, testSha(11), "zlib"));
+    const auto second = readFile(makeCache(dir.path, testSha(13), "curl"));
+    Store store{dir.path, Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+    TestServer server{store};
+
+    // Missing caches are left out and duplicates are sent once
+    const auto body =
+        fmt::format("{} {} {} {}", testSha(11), testSha(12), testSha(11), testSha(13));
+    const auto res = server.client().Post("/cache/bundle", body, "text/plain");
+    REQUIRE(res);
+    CHECK(res->status == httplib::StatusCode::OK_200);
+    CHECK(res->get_header_value("Content-Type") == "application/x-tar");
+    CHECK(res->body.size() % tarBlockSize == 0);
+
+    std::vector<std::pair<std::string, std::string>> files;
+    TarParser parser{
+        [&](const TarEntry& entry) { files.emplace_back(entry.name, ""); },
+        [&](std::span<const char> data) { files.back().second.append(data.data(), data.size()); },
+        [] {}};
+    parser.feed(res->body);
+    CHECK(parser.done());
+    REQUIRE(files.size() == 2);
+    CHECK(files[0].first == fmt::format("{}.zip", testSha(11)));
+    CHECK(files[0].second == first);
+    CHECK(files[1].first == fmt::format("{}.zip", testSha(13)));
+    CHECK(files[1].second == second);
+    CHECK(server.db.count<db::Download>() == 2);
+}
+
+// ============================================================================
+// POST /cache/batch
+// ============================================================================
+
+TEST_CASE("Batch uploads of many caches are all committed", "[server]") {
+    TempDir dir;
+    Store store{dir.path / "store", Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+    TestServer server{store};
+
+    // Many more caches than commits may run at once
+    constexpr size_t count = 64;
+    std::vector<std::string> contents;
+    for (size_t i = 0; i < count; ++i) {
+        contents.push_back(readFile(makeCache(dir.path / "source", testSha(100 + i), "zlib")));
+    }
+    TarStream tar;
+    for (size_t i = 0; i < count; ++i) {
+        tar.add(fmt::format("{}.zip", testSha(100 + i)), Time{}, contents[i]);
+    }
+    std::string body;
+    for (auto part = tar.chunk(0, tar.size()); !part.empty();
+         part = tar.chunk(body.size(), tar.size())) {
+        body.append(part.data(), part.size());
+    }
+
+    const auto auth = fmt::format("Bearer {}", TestServer::token);
+    const auto res = server.client().Post("/cache/batch", {{"Authorization", auth}}, body,
+                                          "application/x-tar");
+    REQUIRE(res);
+    CHECK(res->status == httplib::StatusCode::OK_200);
+    for (size_t i = 0; i < count; ++i) {
+        CHECK(res->body.contains(fmt::format("{}.zip 201", testSha(100 + i))));
+        const auto reader = store.read(testKey(100 + i));
+        REQUIRE(reader);
+        CHECK(reader->size() == contents[i].size());
+    }
+    CHECK(server.db.count<db::Cache>() == count);
+}
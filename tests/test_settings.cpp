@@ -88,6 +88,22 @@ TEST_CASE("generateConfigYaml default settings: constant-default keys are presen
     // maintenance section is always emitted
     REQUIRE(doc["maintenance"]);
     CHECK(doc["maintenance"]["dry_run"].as<bool>() == false);
+
+    // storage section is emitted with scan_threads commented out
+    CHECK_FALSE(doc["storage"]["scan_threads"]);
+    CHECK(doc["storage"]["details_cache_size"].as<size_t>() == 4096);
+    CHECK(std::chrono::duration_cast<std::chrono::seconds>(
+              doc["storage"]["miss_cache_ttl"].as<Duration>())
+              .count() == 10);
+    CHECK(std::chrono::duration_cast<std::chrono::hours>(
+              doc["storage"]["upload_session_ttl"].as<Duration>())
+              .count() == 24);
+    CHECK(doc["storage"]["upload_buffer_size"].as<ByteSize>() == ByteSize{4'000'000});
+    CHECK(doc["storage"]["direct_uploads"].as<bool>() == false);
+    CHECK(doc["storage"]["durability"].as<std::string>() == "none");
+    CHECK(std::chrono::duration_cast<std::chrono::milliseconds>(
+              doc["storage"]["group_commit_interval"].as<Duration>())
+              .count() == 10);
 }
 
 TEST_CASE("generateConfigYaml reflects explicitly set values", "[settings][generate_config]") {
@@ -105,6 +121,14 @@ TEST_CASE("generateConfigYaml reflects explicitly set values", "[settings][gener
     s.maintenance.maxPackageSize = ByteSize{1'000'000'000};  // 1GB
     s.maintenance.maxAge = std::chrono::duration_cast<Duration>(std::chrono::years{1});
     s.maintenance.maxUnused = std::chrono::duration_cast<Duration>(std::chrono::days{30});
+    s.storage.scanThreads = 12;
+    s.storage.detailsCacheSize = 100;
+    s.storage.missCacheTtl = std::chrono::minutes{2};
+    s.storage.uploadSessionTtl = std::chrono::hours{6};
+    s.storage.uploadBufferSize = ByteSize{16'000'000};
+    s.storage.directUploads = true;
+    s.storage.durability = Durability::Group;
+    s.storage.groupCommitInterval = std::chrono::milliseconds{1500};
 
     const auto yaml = generateConfigYaml(s);
     REQUIRE_NOTHROW(YAML::Load(yaml));
@@ -122,6 +146,12 @@ TEST_CASE("generateConfigYaml reflects explicitly set values", "[settings][gener
     CHECK(doc["maintenance"]["dry_run"].as<bool>() == true);
     CHECK(doc["maintenance"]["max_total_size"].as<ByteSize>() == ByteSize{100'000'000'000});
     CHECK(doc["maintenance"]["max_package_size"].as<ByteSize>() == ByteSize{1'000'000'000});
+    CHECK(doc["storage"]["scan_threads"].as<size_t>() == 12);
+    CHECK(doc["storage"]["details_cache_size"].as<size_t>() == 100);
+    CHECK(doc["storage"]["upload_buffer_size"].as<ByteSize>() == ByteSize{16'000'000});
+    CHECK(doc["storage"]["direct_uploads"].as<bool>() == true);
+    CHECK(doc["storage"]["durability"].as<std::string>() == "group");
+    CHECK(doc["storage"]["group_commit_interval"].as<std::string>() == "1s 500ms");
 
     // Compare durations via std::chrono::seconds (rep is long long, unambiguously printable on all
     // platforms including macOS/ARM64 where Duration::rep is __int128).
@@ -133,6 +163,8 @@ TEST_CASE("generateConfigYaml reflects explicitly set values", "[settings][gener
           toSec(c::duration_cast<Duration>(c::years{1})));
     CHECK(toSec(doc["maintenance"]["max_unused"].as<Duration>()) ==
           toSec(c::duration_cast<Duration>(c::days{30})));
+    CHECK(toSec(doc["storage"]["miss_cache_ttl"].as<Duration>()) == 120);
+    CHECK(toSec(doc["storage"]["upload_session_ttl"].as<Duration>()) == 6 * 3600);
 
     // Verify that the formatted duration strings are human-readable
     CHECK(doc["maintenance"]["max_age"].as<std::string>() == "1y");
@@ -0,0 +1,117 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <vcpkg-cache-server/sha.hpp>
+
+#include "test_utils.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <string>
+
+using namespace vcache;
+using namespace vcache::test;
+
+// ============================================================================
+// Sha
+// ============================================================================
+
+TEST_CASE("Sha parses and formats hex strings", "[sha]") {
+    const auto str = testSha(5);
+    const auto sha = Sha::parse(str);
+    REQUIRE(sha);
+    CHECK(sha->str() == str);
+    CHECK(fmt::format("{}", *sha) == str);
+    CHECK(sha->bytes[0] == (5 * 37) % 256);
+    CHECK(sha->bytes[31] == 5);
+}
+
+TEST_CASE("Sha rejects invalid strings", "[sha]") {
+    CHECK_FALSE(Sha::parse(""));
+    CHECK_FALSE(Sha::parse(testSha(1).substr(1)));
+    CHECK_FALSE(Sha::parse(testSha(1) + "0"));
+    CHECK_FALSE(Sha::parse(std::string(63, '0') + "g"));
+
+    // Upper case digits would not match the lower case cache file names
+    auto upper = testSha(1);
+    std::ranges::transform(upper, upper.begin(), [](char c) { return std::toupper(c); });
+    CHECK_FALSE(Sha::parse(upper));
+    CHECK_FALSE(Sha::parse(std::string(63, '0') + "A"));
+}
+
+TEST_CASE("parseShas splits lists of shas", "[sha]") {
+    const auto list = parseShas(fmt::format(" {}\n{},{}\r\n", testSha(1), testSha(2), testSha(3)));
+    REQUIRE(list);
+    REQUIRE(list->size() == 3);
+    CHECK(list->at(0) == testKey(1));
+    CHECK(list->at(2) == testKey(3));
+
+    CHECK(parseShas("")->empty());
+    CHECK(parseShas(" ,\n")->empty());
+    CHECK_FALSE(parseShas(fmt::format("{} abc", testSha(1))));
+}
+
+// ============================================================================
+// ShaMap
+// ============================================================================
+
+TEST_CASE("ShaMap inserts, finds and erases", "[sha]") {
+    ShaMap<size_t> map;
+    CHECK(map.empty());
+    CHECK(map.find(testKey(1)) == map.end());
+
+    for (size_t i = 0; i < 1000; ++i) {
+        CHECK(map.try_emplace(testKey(i), i).second);
+    }
+    CHECK_FALSE(map.try_emplace(testKey(7), 42).second);
+    REQUIRE(map.size() == 1000);
+    CHECK(static_cast<size_t>(std::ranges::distance(map)) == 1000);
+
+    for (size_t i = 0; i < 1000; i += 2) {
+        CHECK(map.erase(testKey(i)) == 1);
+    }
+    CHECK(map.erase(testKey(0)) == 0);
+    REQUIRE(map.size() == 500);
+    const auto capacity = map.capacity();
+
+    for (size_t i = 0; i < 1000; ++i) {
+        const auto it = map.find(testKey(i));
+        if (i % 2 == 0) {
+            CHECK(it == map.end());
+        } else {
+            REQUIRE(it != map.end());
+            CHECK(it->second == i);
+        }
+    }
+
+    // The slots are released when the map is emptied
+    for (size_t i = 1; i < 1000; i += 2) {
+        CHECK(map.erase(testKey(i)) == 1);
+    }
+    CHECK(map.empty());
+    CHECK(map.capacity() < capacity);
+    CHECK(map.capacity() <= 32);
+}
+
+TEST_CASE("ShaMap matches std::map under random operations", "[sha]") {
+    ShaMap<size_t> map;
+    std::map<Sha, size_t> reference;
+    size_t state = 12345;
+    for (size_t i = 0; i < 20'000; ++i) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        const auto key = testKey((state >> 33) % 512);
+        if ((state >> 20) % 3 == 0) {
+            CHECK(map.erase(key) == reference.erase(key));
+        } else {
+            CHECK(map.try_emplace(key, i).second == reference.try_emplace(key, i).second);
+        }
+    }
+    REQUIRE(map.size() == reference.size());
+    for (const auto& [key, value] : reference) {
+        const auto it = map.find(key);
+        REQUIRE(it != map.end());
+        CHECK(it->second == value);
+    }
+}
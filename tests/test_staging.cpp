@@ -0,0 +1,81 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <vcpkg-cache-server/staging.hpp>
+
+#include "test_utils.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+using namespace vcache;
+using namespace vcache::test;
+
+// ============================================================================
+// Staging
+// ============================================================================
+
+TEST_CASE("Staging creates and removes upload sessions", "[staging]") {
+    TempDir dir;
+    Staging staging{dir.path / ".staging", std::chrono::hours{1}, testLogger()};
+
+    const auto session = staging.create(testKey(1));
+    REQUIRE(session);
+    CHECK(session->id.size() == 32);
+    CHECK(session->sha == testKey(1));
+    CHECK(std::filesystem::file_size(session->path) == 0);
+    CHECK(session->path.parent_path() == staging.directory());
+
+    CHECK(staging.find(session->id) == session);
+    CHECK(staging.find("0123456789abcdef0123456789abcdef") == nullptr);
+    CHECK(staging.create(testKey(1))->id != session->id);
+
+    staging.remove(*session);
+    CHECK(session->closed);
+    CHECK(staging.find(session->id) == nullptr);
+    CHECK_FALSE(std::filesystem::exists(session->path));
+}
+
+TEST_CASE("Staging restores sessions after a restart", "[staging]") {
+    TempDir dir;
+    std::string id;
+    {
+        Staging staging{dir.path, std::chrono::hours{1}, testLogger()};
+        const auto session = staging.create(testKey(2));
+        id = session->id;
+        std::ofstream{session->path, std::ios_base::binary} << "partial data";
+    }
+    std::ofstream{dir.path / "unknown.txt"} << "not a session";
+
+    Staging staging{dir.path, std::chrono::hours{1}, testLogger()};
+    const auto session = staging.find(id);
+    REQUIRE(session);
+    CHECK(session->sha == testKey(2));
+    CHECK(std::filesystem::file_size(session->path) == 12);
+    CHECK(std::filesystem::exists(dir.path / "unknown.txt"));
+}
+
+TEST_CASE("Staging removes expired sessions", "[staging]") {
+    TempDir dir;
+    Staging staging{dir.path, std::chrono::hours{1}, testLogger()};
+    const auto fresh = staging.create(testKey(1));
+    const auto stale = staging.create(testKey(2));
+    std::filesystem::last_write_time(stale->path,
+                                     std::filesystem::last_write_time(stale->path) -
+                                         std::chrono::hours{2});
+
+    SECTION("idle") {
+        staging.prune();
+        CHECK(staging.find(fresh->id) == fresh);
+        CHECK(staging.find(stale->id) == nullptr);
+        CHECK(stale->closed);
+        CHECK_FALSE(std::filesystem::exists(stale->path));
+    }
+    SECTION("busy sessions are kept") {
+        std::scoped_lock lock{stale->mtx};
+        staging.prune();
+        CHECK(staging.find(stale->id) == stale);
+    }
+}
@@ -0,0 +1,690 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <vcpkg-cache-server/store.hpp>
+
+#include "test_utils.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <ranges>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace vcache;
+using namespace vcache::test;
+
+// ============================================================================
+// extractInfo
+// ============================================================================
+
+TEST_CASE("extractInfo reads CONTROL and abi info", "[store]") {
+    TempDir dir;
+    const auto sha = testSha(1);
+    const auto path = makeCache(dir.path, sha, "zlib", "1.3.1", "x64-linux");
+
+    const auto info = extractInfo(path);
+    CHECK(info.package == "zlib");
+    CHECK(info.version == "1.3.1");
+    CHECK(info.arch == "x64-linux");
+    CHECK(info.sha.str() == sha);
+    CHECK(info.size == std::filesystem::file_size(path));
+
+    const auto details = extractDetails(path);
+    REQUIRE(details);
+    CHECK(fp::mGet(details->abi(), "cmake") == "3.30.1");
+    CHECK(fp::mGet(details->abi(), "triplet") == "x64-linux");
+    CHECK(fp::mGet(details->ctrl(), "Package") == "zlib");
+    CHECK(fp::mGet(details->ctrl(), "Version") == "1.3.1");
+}
+
+TEST_CASE("extractInfo throws on invalid files", "[store]") {
+    TempDir dir;
+    const auto path = dir.path / "ab" / fmt::format("{}.zip", testSha(2));
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream{path} << "not a zip file";
+
+    CHECK_THROWS(extractInfo(path));
+    CHECK_THROWS(extractDetails(path));
+}
+
+// ============================================================================
+// scan
+// ============================================================================
+
+TEST_CASE("scan finds all caches using multiple threads", "[store][scan]") {
+    TempDir dir;
+    constexpr size_t count = 50;
+    for (size_t i = 0; i < count; ++i) {
+        makeCache(dir.path, testSha(i), fmt::format("package-{}", i % 7));
+    }
+
+    for (const size_t threads : {size_t{1}, size_t{4}, size_t{16}}) {
+        const auto infos = scan(dir.path, threads, {}, testLogger());
+        REQUIRE(infos.size() == count);
+        for (size_t i = 0; i < count; ++i) {
+            const auto it = infos.find(testKey(i));
+            REQUIRE(it != infos.end());
+            CHECK(it->second.first == InfoState::Valid);
+            CHECK(it->second.second.package == fmt::format("package-{}", i % 7));
+        }
+    }
+}
+
+TEST_CASE("scan removes files that can not be extracted", "[store][scan]") {
+    TempDir dir;
+    makeCache(dir.path, testSha(1), "zlib");
+    const auto broken = dir.path / "ff" / fmt::format("ff{:062x}.zip", 2);
+    std::filesystem::create_directories(broken.parent_path());
+    std::ofstream{broken} << "not a zip file";
+
+    const auto infos = scan(dir.path, 2, {}, testLogger());
+    CHECK(infos.size() == 1);
+    CHECK_FALSE(std::filesystem::exists(broken));
+}
+
+TEST_CASE("scan skips files not named by a sha", "[store][scan]") {
+    TempDir dir;
+    makeCache(dir.path, testSha(1), "zlib");
+    const auto other = makeCache(dir.path, "not-a-sha", "zlib");
+
+    const auto infos = scan(dir.path, 2, {}, testLogger());
+    CHECK(infos.size() == 1);
+    CHECK(infos.contains(testKey(1)));
+    CHECK(std::filesystem::exists(other));
+    CHECK_THROWS(extractInfo(other));
+}
+
+TEST_CASE("scan skips caches outside the directory of their sha", "[store][scan]") {
+    TempDir dir;
+    makeCache(dir.path, testSha(1), "zlib");
+    const auto copy = makeCache(dir.path / "copy", testSha(1), "fmt");
+    const auto misplaced = makeCache(dir.path / "copy", testSha(2), "fmt");
+
+    for (const size_t threads : {size_t{1}, size_t{4}}) {
+        const auto infos = scan(dir.path, threads, {}, testLogger());
+        REQUIRE(infos.size() == 1);
+        const auto it = infos.find(testKey(1));
+        REQUIRE(it != infos.end());
+        CHECK(it->second.second.package == "zlib");
+        CHECK(std::filesystem::exists(copy));
+        CHECK(std::filesystem::exists(misplaced));
+    }
+}
+
+// ============================================================================
+// Store
+// ============================================================================
+
+TEST_CASE("Store scans existing caches on construction", "[store]") {
+    TempDir dir;
+    for (size_t i = 0; i < 10; ++i) {
+        makeCache(dir.path, testSha(i), "zlib");
+    }
+
+    Store store{dir.path, Storage{.scanThreads = 3}, testLogger()};
+    REQUIRE(store.waitForScan());
+    CHECK(std::ranges::distance(store.allInfos()) == 10);
+    REQUIRE(store.info(testKey(3)) != nullptr);
+    CHECK(store.info(testKey(3))->package == "zlib");
+    CHECK(store.info(testKey(42)) == nullptr);
+}
+
+TEST_CASE("Store reports scan progress", "[store][scan]") {
+    TempDir dir;
+    for (size_t i = 0; i < 10; ++i) {
+        makeCache(dir.path, testSha(i), "zlib");
+    }
+    const auto broken = dir.path / "ff" / fmt::format("ff{:062x}.zip", 99);
+    std::filesystem::create_directories(broken.parent_path());
+    std::ofstream{broken} << "not a zip file";
+
+    Store store{dir.path, Storage{.scanThreads = 2}, testLogger()};
+    REQUIRE(store.waitForScan());
+
+    const auto status = store.scanStatus();
+    CHECK(status.done);
+    CHECK(status.total == 11);
+    CHECK(status.processed == 11);
+    CHECK(status.failed == 1);
+    CHECK_FALSE(std::filesystem::exists(broken));
+}
+
+TEST_CASE("Store only looks up unknown caches on disk while scanning", "[store][scan]") {
+    TempDir dir;
+    makeCache(dir.path, testSha(1), "zlib");
+
+    Store store{dir.path, Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+
+    // A file added behind the back of the store is not served after the scan...
+    makeCache(dir.path, testSha(2), "curl");
+    CHECK(store.read(testKey(2)) == nullptr);
+    // ...but can still be found explicitly
+    REQUIRE(store.info(testKey(2)) != nullptr);
+    CHECK(store.read(testKey(2)) != nullptr);
+    CHECK(store.read(testKey(1)) != nullptr);
+}
+
+TEST_CASE("Store looks up many shas from the index at once", "[store]") {
+    TempDir dir;
+    for (size_t i = 0; i < 100; i += 2) {
+        makeCache(dir.path, testSha(i), "zlib");
+    }
+    Store store{dir.path, Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+
+    std::vector<Sha> shas;
+    for (size_t i = 100; i-- > 0;) shas.push_back(testKey(i));
+    const auto infos = store.infos(shas);
+    REQUIRE(infos.size() == shas.size());
+    for (size_t i = 0; i < shas.size(); ++i) {
+        if (shas[i].bytes[31] % 2 == 0) {
+            REQUIRE(infos[i] != nullptr);
+            CHECK(infos[i]->sha == shas[i]);
+        } else {
+            CHECK(infos[i] == nullptr);
+        }
+    }
+    CHECK(store.infos({}).empty());
+}
+
+TEST_CASE("Store remembers missing caches", "[store]") {
+    TempDir dir;
+    Store store{dir.path, Storage{.missCacheTtl = std::chrono::hours{1}}, testLogger()};
+    REQUIRE(store.waitForScan());
+
+    CHECK(store.info(testKey(1)) == nullptr);
+    makeCache(dir.path, testSha(1), "zlib");
+    // The miss is remembered, the file system is not checked again
+    CHECK(store.info(testKey(1)) == nullptr);
+
+    // Writing checks the file system and picks up the existing file
+    CHECK(store.write(testKey(1)) == nullptr);
+    REQUIRE(store.info(testKey(1)) != nullptr);
+    CHECK(store.info(testKey(1))->package == "zlib");
+}
+
+TEST_CASE("Store drops removed entries while readers keep them alive", "[store]") {
+    TempDir dir;
+    for (size_t i = 0; i < 5; ++i) {
+        makeCache(dir.path, testSha(i), "zlib");
+    }
+    Store store{dir.path, Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+    REQUIRE(store.size() == 5);
+
+    const auto reader = store.read(testKey(1));
+    REQUIRE(reader);
+    const auto content = [&]() {
+        std::ifstream stream{dir.path / testSha(1).substr(0, 2) / (testSha(1) + ".zip"),
+                             std::ios_base::binary};
+        return std::string{std::istreambuf_iterator<char>{stream}, {}};
+    }();
+    store.remove(testKey(1));
+    CHECK(store.size() == 4);
+    CHECK(store.read(testKey(1)) == nullptr);
+    CHECK(reader->getInfo().package == "zlib");
+    CHECK(reader->getInfo().sha == testKey(1));
+    // The mapping outlives the file
+    CHECK(reader->data().size() == reader->getInfo().size);
+    CHECK(std::string_view{reader->data().data(), reader->data().size()} == content);
+
+    std::string read(content.size() + 10, '\0');
+    CHECK(reader->read(0, read) == content.size());
+    CHECK(read.substr(0, content.size()) == content);
+    CHECK(reader->read(10, std::span{read}.first(5)) == 5);
+    CHECK(read.substr(0, 5) == content.substr(10, 5));
+    CHECK(reader->read(content.size(), read) == 0);
+}
+
+TEST_CASE("Store can write a removed cache again", "[store]") {
+    TempDir dir;
+    const auto path = makeCache(dir.path, testSha(1), "zlib");
+    Store store{dir.path, Storage{.missCacheTtl = Duration{0}}, testLogger()};
+    REQUIRE(store.waitForScan());
+
+    store.remove(testKey(1));
+    CHECK_FALSE(std::filesystem::exists(path));
+    CHECK(store.info(testKey(1)) == nullptr);
+
+    const auto source = makeCache(dir.path / "source", testSha(1), "curl");
+    {
+        const auto writer = store.write(testKey(1));
+        REQUIRE(writer);
+        CHECK(store.write(testKey(1)) == nullptr);
+        const auto content = readFile(source);
+    writer->write(content.data(), content.size());
+        writer->commit();
+    }
+    REQUIRE(store.info(testKey(1)) != nullptr);
+    CHECK(store.info(testKey(1))->package == "curl");
+}
+
+TEST_CASE("Store discards writers that are not committed", "[store]") {
+    TempDir dir;
+    Store store{dir.path, Storage{.missCacheTtl = Duration{0}}, testLogger()};
+    REQUIRE(store.waitForScan());
+    const auto path = dir.path / testSha(1).substr(0, 2) / fmt::format("{}.zip", testSha(1));
+
+    SECTION("abandoned") {
+        const auto writer = store.write(testKey(1));
+        REQUIRE(writer);
+        writer->write("partial upload", 14);
+    }
+    SECTION("invalid") {
+        const auto writer = store.write(testKey(1));
+        REQUIRE(writer);
+        writer->write("not a zip file", 14);
+        CHECK_THROWS(writer->commit());
+    }
+    CHECK_FALSE(std::filesystem::exists(path));
+    CHECK(std::filesystem::is_empty(dir.path / ".uploads"));
+    CHECK(store.info(testKey(1)) == nullptr);
+
+    // The sha is free to be written again
+    const auto source = makeCache(dir.path / "source", testSha(1), "zlib");
+    const auto writer = store.write(testKey(1));
+    REQUIRE(writer);
+    const auto content = readFile(source);
+    writer->write(content.data(), content.size());
+    const auto info = writer->commit();
+    REQUIRE(info);
+    CHECK(info->package == "zlib");
+    CHECK(store.info(testKey(1)) == info);
+}
+
+TEST_CASE("Store knows shas that are valid or being written", "[store]") {
+    TempDir dir;
+    makeCache(dir.path, testSha(1), "zlib");
+    Store store{dir.path, Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+
+    CHECK(store.known(testKey(1)));
+    CHECK_FALSE(store.known(testKey(2)));
+    {
+        const auto writer = store.write(testKey(2));
+        REQUIRE(writer);
+        CHECK(store.known(testKey(2)));
+    }
+    // The abandoned write released the sha
+    CHECK_FALSE(store.known(testKey(2)));
+}
+
+TEST_CASE("Store lets readers follow running uploads", "[store]") {
+    TempDir dir;
+    Store store{dir.path, Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+
+    const auto source = makeCache(dir.path / "source", testSha(1), "zlib");
+    const auto content = readFile(source);
+
+    CHECK(store.tail(testKey(1)) == nullptr);
+    auto writer = store.write(testKey(1), content.size());
+    REQUIRE(writer);
+    const auto tail = store.tail(testKey(1));
+    REQUIRE(tail);
+    CHECK(tail->expectedSize() == content.size());
+
+    std::string received;
+    bool failed = false;
+    std::jthread follower{[&]() {
+        std::array<char, 64> buffer;
+        try {
+            while (const auto n = tail->read(received.size(), buffer)) {
+                received.append(buffer.data(), n);
+            }
+        } catch (const std::exception&) {
+            failed = true;
+        }
+    }};
+
+    SECTION("committed") {
+        for (size_t i = 0; i < content.size(); i += 100) {
+            writer->write(content.data() + i, std::min(size_t{100}, content.size() - i));
+        }
+        writer->commit();
+        follower.join();
+        CHECK_FALSE(failed);
+        CHECK(received == content);
+        CHECK(store.tail(testKey(1)) == nullptr);
+    }
+    SECTION("failed") {
+        writer->write(content.data(), content.size() / 2);
+        writer.reset();
+        follower.join();
+        CHECK(failed);
+        CHECK(store.tail(testKey(1)) == nullptr);
+        CHECK(store.info(testKey(1)) == nullptr);
+    }
+}
+
+TEST_CASE("Store commits files received elsewhere", "[store]") {
+    TempDir dir;
+    Store store{dir.path, Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+
+    const auto staged = dir.path / "staged.part";
+    std::filesystem::copy_file(makeCache(dir.path / "source", testSha(1), "zlib"), staged);
+
+    const auto info = store.commit(testKey(1), staged);
+    REQUIRE(info);
+    CHECK(info->package == "zlib");
+    CHECK(info->sha == testKey(1));
+    CHECK_FALSE(std::filesystem::exists(staged));
+    CHECK(store.info(testKey(1)) == info);
+    CHECK(store.read(testKey(1)) != nullptr);
+    // Nothing went through the uploads, there was never an upload to follow
+    CHECK(std::filesystem::is_empty(dir.path / ".uploads"));
+
+    // A cache that exists is not replaced
+    std::filesystem::copy_file(makeCache(dir.path / "other", testSha(1), "curl"), staged);
+    CHECK(store.commit(testKey(1), staged) == nullptr);
+    CHECK(store.info(testKey(1)) == info);
+
+    // An invalid file is rejected and the sha stays free
+    std::ofstream{dir.path / "invalid.part"} << "not a zip";
+    CHECK_THROWS(store.commit(testKey(2), dir.path / "invalid.part"));
+    CHECK(store.info(testKey(2)) == nullptr);
+    CHECK(store.write(testKey(2)) != nullptr);
+}
+
+TEST_CASE("Store writes uploads through the upload buffer", "[store]") {
+    for (const bool direct : {false, true}) {
+        TempDir dir;
+        Store store{dir.path, Storage{.uploadBufferSize = ByteSize{100}, .directUploads = direct},
+                    testLogger()};
+        REQUIRE(store.waitForScan());
+
+        const auto content = readFile(makeCache(dir.path / "source", testSha(1), "zlib"));
+        const auto writer = store.write(testKey(1), content.size());
+        REQUIRE(writer);
+        for (size_t i = 0; i < content.size(); i += 7) {
+            writer->write(content.data() + i, std::min(size_t{7}, content.size() - i));
+        }
+        const auto info = writer->commit();
+        REQUIRE(info);
+        CHECK(info->size == content.size());
+        CHECK(readFile(dir.path / testSha(1).substr(0, 2) / fmt::format("{}.zip", testSha(1))) ==
+              content);
+    }
+}
+
+TEST_CASE("Store publishes uploads with a rename", "[store]") {
+    TempDir dir;
+    // Left over by an upload that was interrupted
+    std::filesystem::create_directories(dir.path / ".uploads");
+    std::ofstream{dir.path / ".uploads" / fmt::format("{}.tmp", testSha(2))} << "partial";
+
+    Store store{dir.path, Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+    CHECK(std::filesystem::is_empty(dir.path / ".uploads"));
+    CHECK(store.info(testKey(2)) == nullptr);
+
+    const auto path = dir.path / testSha(1).substr(0, 2) / fmt::format("{}.zip", testSha(1));
+    const auto content = readFile(makeCache(dir.path / "source", testSha(1), "zlib"));
+    const auto writer = store.write(testKey(1), content.size());
+    REQUIRE(writer);
+    writer->write(content.data(), content.size());
+    CHECK_FALSE(std::filesystem::exists(path));
+
+    REQUIRE(writer->commit());
+    CHECK(readFile(path) == content);
+    CHECK(std::filesystem::is_empty(dir.path / ".uploads"));
+}
+
+TEST_CASE("Store syncs uploads according to the durability", "[store]") {
+    for (const auto durability : {Durability::None, Durability::Fsync, Durability::Group}) {
+        TempDir dir;
+        Store store{dir.path,
+                    Storage{.durability = durability,
+                            .groupCommitInterval = std::chrono::milliseconds{20}},
+                    testLogger()};
+        REQUIRE(store.waitForScan());
+
+        // Concurrent uploads share the rounds of the group commit
+        constexpr size_t uploads = 8;
+        std::array<std::string, uploads> contents;
+        for (size_t i = 0; i < uploads; ++i) {
+            contents[i] = readFile(makeCache(dir.path / "source", testSha(i), "zlib"));
+        }
+        std::atomic<size_t> committed{0};
+        {
+            std::vector<std::jthread> threads;
+            for (size_t i = 0; i < uploads; ++i) {
+                threads.emplace_back([&, i]() {
+                    const auto writer = store.write(testKey(i));
+                    writer->write(contents[i].data(), contents[i].size());
+                    if (writer->commit()) ++committed;
+                });
+            }
+        }
+        CHECK(committed == uploads);
+        CHECK(store.size() == uploads);
+    }
+}
+
+TEST_CASE("Store lets readers follow an upload across its commit", "[store]") {
+    TempDir dir;
+    // A long group commit interval keeps the commit waiting for the sync of the directory after
+    // the rename
+    Store store{dir.path,
+                Storage{.durability = Durability::Group,
+                        .groupCommitInterval = std::chrono::milliseconds{500}},
+                testLogger()};
+    REQUIRE(store.waitForScan());
+
+    const auto content = readFile(makeCache(dir.path / "source", testSha(1), "zlib"));
+    const auto writer = store.write(testKey(1), content.size());
+    REQUIRE(writer);
+    writer->write(content.data(), content.size());
+    std::jthread committer{[&]() { writer->commit(); }};
+
+    const auto tmp = dir.path / ".uploads" / fmt::format("{}.tmp", testSha(1));
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{10};
+    while (std::filesystem::exists(tmp) && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+    REQUIRE_FALSE(std::filesystem::exists(tmp));
+
+    // Renamed but not yet published
+    const auto tail = store.tail(testKey(1));
+    REQUIRE(tail);
+    std::string received;
+    std::array<char, 64> buffer;
+    while (const auto n = tail->read(received.size(), buffer)) {
+        received.append(buffer.data(), n);
+    }
+    CHECK(received == content);
+    committer.join();
+    CHECK(store.read(testKey(1)) != nullptr);
+}
+
+TEST_CASE("Store indexes caches by package and arch", "[store]") {
+    TempDir dir;
+    for (size_t i = 0; i < 12; ++i) {
+        makeCache(dir.path, testSha(i), fmt::format("package-{}", i % 3), "1.0.0",
+                  i % 2 == 0 ? "x64-linux" : "arm64-linux");
+    }
+    Store store{dir.path, Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+
+    const auto shas = [&](std::string_view package, std::optional<std::string_view> arch) {
+        return store.packageInfos(package, arch) |
+               std::views::transform([](const auto& info) { return info->sha; }) |
+               std::ranges::to<std::set>();
+    };
+    CHECK(shas("package-0", std::nullopt) ==
+          std::set{testKey(0), testKey(3), testKey(6), testKey(9)});
+    CHECK(shas("package-0", "x64-linux") == std::set{testKey(0), testKey(6)});
+    CHECK(shas("package-0", "x86-windows").empty());
+    CHECK(shas("zlib", std::nullopt).empty());
+
+    store.remove(testKey(6));
+    CHECK(shas("package-0", "x64-linux") == std::set{testKey(0)});
+    store.remove(testKey(0));
+    CHECK(shas("package-0", "x64-linux").empty());
+
+    const auto source = makeCache(dir.path / "source", testSha(42), "zlib");
+    {
+        const auto writer = store.write(testKey(42));
+        REQUIRE(writer);
+        const auto content = readFile(source);
+    writer->write(content.data(), content.size());
+        writer->commit();
+    }
+    CHECK(shas("zlib", "x64-linux") == std::set{testKey(42)});
+}
+
+TEST_CASE("Store keeps package summaries up to date", "[store]") {
+    TempDir dir;
+    const auto base = std::filesystem::last_write_time(makeCache(dir.path, testSha(0), "zlib"));
+    for (size_t i = 1; i < 6; ++i) {
+        const auto path = makeCache(dir.path, testSha(i), i < 4 ? "zlib" : "curl");
+        std::filesystem::last_write_time(path, base + std::chrono::hours{i});
+    }
+    Store store{dir.path, Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+
+    const auto summary = [&](std::string_view name) {
+        const auto all = store.packageSummaries();
+        const auto it = std::ranges::find(all, name, &PackageSummary::name);
+        return it == all.end() ? std::optional<PackageSummary>{} : *it;
+    };
+    const auto sizeOf = [&](size_t i) { return store.info(testKey(i))->size; };
+    const auto hoursOf = [&](Time time) {
+        return std::chrono::duration_cast<std::chrono::hours>(time - base).count();
+    };
+
+    auto zlib = summary("zlib");
+    REQUIRE(zlib);
+    CHECK(zlib->count == 4);
+    CHECK(zlib->size == sizeOf(0) + sizeOf(1) + sizeOf(2) + sizeOf(3));
+    CHECK(hoursOf(zlib->first) == 0);
+    CHECK(hoursOf(zlib->last) == 3);
+    CHECK(store.totals().caches == 6);
+    CHECK(store.totals().packages == 2);
+
+    const auto removedSize = sizeOf(0) + sizeOf(3);
+    const auto totalSize = store.totals().size;
+    store.remove(testKey(0));
+    store.remove(testKey(3));
+    zlib = summary("zlib");
+    REQUIRE(zlib);
+    CHECK(zlib->count == 2);
+    CHECK(hoursOf(zlib->first) == 1);
+    CHECK(hoursOf(zlib->last) == 2);
+    CHECK(store.totals().size == totalSize - removedSize);
+
+    store.remove(testKey(4));
+    store.remove(testKey(5));
+    CHECK_FALSE(summary("curl"));
+    CHECK(store.totals().caches == 2);
+    CHECK(store.totals().packages == 1);
+}
+
+TEST_CASE("Store loads details on demand", "[store]") {
+    TempDir dir;
+    for (size_t i = 0; i < 5; ++i) {
+        makeCache(dir.path, testSha(i), fmt::format("package-{}", i));
+    }
+
+    Store store{dir.path, Storage{.detailsCacheSize = 2}, testLogger()};
+    REQUIRE(store.waitForScan());
+
+    const auto details = store.details(testKey(1));
+    REQUIRE(details);
+    CHECK(fp::mGet(details->ctrl(), "Package") == "package-1");
+    CHECK(store.details(testKey(1)) == details);
+    CHECK(store.details(testKey(42)) == nullptr);
+
+    // Evicted details are loaded again
+    store.details(testKey(2));
+    store.details(testKey(3));
+    const auto reloaded = store.details(testKey(1));
+    REQUIRE(reloaded);
+    CHECK(reloaded != details);
+    CHECK(fp::mGet(reloaded->ctrl(), "Package") == "package-1");
+
+    store.remove(testKey(1));
+    CHECK(store.details(testKey(1)) == nullptr);
+}
+
+TEST_CASE("Store allInfos is a snapshot that does not block writers", "[store]") {
+    TempDir dir;
+    for (size_t i = 0; i < 5; ++i) {
+        makeCache(dir.path, testSha(i), "zlib");
+    }
+    Store store{dir.path, Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+
+    const auto before = store.allInfos();
+    // With a lock held by the snapshot this would dead lock
+    store.remove(testKey(1));
+    makeCache(dir.path, testSha(7), "curl");
+    REQUIRE(store.info(testKey(7)) != nullptr);
+
+    CHECK(std::ranges::distance(before) == 5);
+    CHECK(std::ranges::count(before, testKey(1), &Info::sha) == 1);
+
+    const auto after = store.allInfos();
+    CHECK(std::ranges::distance(after) == 5);
+    CHECK(std::ranges::count(after, testKey(1), &Info::sha) == 0);
+    CHECK(std::ranges::count(after, testKey(7), &Info::sha) == 1);
+}
+
+// ============================================================================
+// Benchmarks, run with: vcpkg-cache-server-tests [benchmark]
+// ============================================================================
+
+TEST_CASE("Store lookup throughput scales with threads", "[.][benchmark]") {
+    TempDir dir;
+    constexpr size_t count = 512;
+    for (size_t i = 0; i < count; ++i) {
+        makeCache(dir.path, testSha(i), fmt::format("package-{}", i % 16));
+    }
+    Store store{dir.path, Storage{}, testLogger()};
+    REQUIRE(store.waitForScan());
+
+    const auto shas = std::views::iota(size_t{0}, count) | std::views::transform(testKey) |
+                      std::ranges::to<std::vector>();
+
+    constexpr size_t opsPerThread = 200'000;
+    for (const size_t threads : {size_t{1}, size_t{2}, size_t{4}, size_t{8}, size_t{16}}) {
+        std::atomic<size_t> misses{0};
+        const auto start = std::chrono::steady_clock::now();
+        {
+            std::vector<std::jthread> workers;
+            for (size_t t = 0; t < threads; ++t) {
+                workers.emplace_back([&, t]() {
+                    for (size_t i = 0; i < opsPerThread; ++i) {
+                        const auto& sha = shas[(i * 7 + t) % count];
+                        // One in ten operations takes the exclusive lock of a shard, writing an
+                        // existing sha is rejected without touching the file system.
+                        if (i % 10 == 0) {
+                            misses += store.write(sha) != nullptr;
+                        } else {
+                            misses += store.info(sha) == nullptr;
+                        }
+                    }
+                });
+            }
+        }
+        const auto secs =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        CHECK(misses == 0);
+        fmt::print("{:2} threads: {:.2f}M ops/s\n", threads,
+                   static_cast<double>(threads * opsPerThread) / secs / 1e6);
+    }
+}
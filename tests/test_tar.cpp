@@ -0,0 +1,244 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <vcpkg-cache-server/tar.hpp>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using namespace vcache;
+
+namespace {
+
+std::string field(const auto& block, size_t offset, size_t length) {
+    std::string_view str{block.data() + offset, length};
+    return std::string{str.substr(0, str.find('\0'))};
+}
+
+unsigned checksum(std::array<char, tarBlockSize> block) {
+    std::fill_n(block.begin() + 148, 8, ' ');
+    unsigned sum = 0;
+    for (const auto c : block) sum += static_cast<unsigned char>(c);
+    return sum;
+}
+
+// Read the whole archive using chunks of at most length bytes
+std::string readAll(const TarStream& tar, size_t length) {
+    std::string res;
+    for (auto part = tar.chunk(0, length); !part.empty(); part = tar.chunk(res.size(), length)) {
+        res.append(part.data(), part.size());
+    }
+    return res;
+}
+
+}  // namespace
+
+// ============================================================================
+// tarHeader
+// ============================================================================
+
+TEST_CASE("tarHeader writes a ustar header", "[tar]") {
+    const auto header = tarHeader("abc.zip", 1000, Time{});
+
+    CHECK(field(header, 0, 100) == "abc.zip");
+    CHECK(field(header, 100, 8) == "0000644");
+    CHECK(field(header, 124, 12) == "00000001750");
+    CHECK(header[156] == '0');
+    CHECK(field(header, 257, 6) == "ustar");
+    CHECK(field(header, 263, 2) == "00");
+    CHECK(std::stoul(field(header, 148, 8), nullptr, 8) == checksum(header));
+}
+
+TEST_CASE("tarHeader uses base-256 for large sizes", "[tar]") {
+    const std::uint64_t size = (std::uint64_t{1} << 33) + 5;
+    const auto header = tarHeader("large.zip", size, Time{});
+
+    CHECK(static_cast<unsigned char>(header[124]) == 0x80);
+    std::uint64_t decoded = 0;
+    for (size_t i = 125; i < 136; ++i) {
+        decoded = decoded << 8 | static_cast<unsigned char>(header[i]);
+    }
+    CHECK(decoded == size);
+    CHECK(std::stoul(field(header, 148, 8), nullptr, 8) == checksum(header));
+}
+
+TEST_CASE("tarHeader rejects invalid names", "[tar]") {
+    CHECK_THROWS(tarHeader("", 0, Time{}));
+    CHECK_THROWS(tarHeader(std::string(101, 'a'), 0, Time{}));
+}
+
+// ============================================================================
+// TarStream
+// ============================================================================
+
+TEST_CASE("TarStream serves any range of the archive", "[tar]") {
+    const std::string small = "abc";
+    const std::string large(1024, 'x');
+
+    TarStream tar;
+    tar.add("small.zip", Time{}, small);
+    tar.add("large.zip", Time{}, large);
+    CHECK(tar.count() == 2);
+    // Each file has a header and is padded to full blocks, followed by two end blocks
+    REQUIRE(tar.size() == 512 + 512 + 512 + 1024 + 1024);
+
+    const auto archive = readAll(tar, 1 << 20);
+    REQUIRE(archive.size() == tar.size());
+    CHECK(field(archive, 0, 100) == "small.zip");
+    CHECK(archive.substr(512, 3) == small);
+    CHECK(std::ranges::all_of(archive.substr(515, 509), [](char c) { return c == '\0'; }));
+    CHECK(field(archive, 1024, 100) == "large.zip");
+    CHECK(archive.substr(1536, 1024) == large);
+    CHECK(std::ranges::all_of(archive.substr(2560), [](char c) { return c == '\0'; }));
+
+    // Chunks are views of the parts, small lengths give the same archive
+    CHECK(readAll(tar, 1) == archive);
+    CHECK(readAll(tar, 7) == archive);
+    CHECK(tar.chunk(512, 1 << 20).data() == small.data());
+    CHECK(tar.chunk(1536 + 100, 10).data() == large.data() + 100);
+    CHECK(tar.chunk(tar.size(), 10).empty());
+}
+
+TEST_CASE("TarStream reads files added with a read function as they are sent", "[tar]") {
+    const std::string small = "abc";
+    const std::string large(5000, 'x');
+    const auto readFrom = [](const std::string& content) {
+        return [&content](std::uint64_t offset, std::span<char> buffer) {
+            const auto part = std::string_view{content}.substr(offset, buffer.size());
+            std::ranges::copy(part, buffer.begin());
+            return part.size();
+        };
+    };
+
+    TarStream mapped;
+    mapped.add("small.zip", Time{}, small);
+    mapped.add("large.zip", Time{}, large);
+    TarStream tar;
+    tar.add("small.zip", Time{}, small);
+    tar.add("large.zip", Time{}, large.size(), readFrom(large));
+    REQUIRE(tar.size() == mapped.size());
+    // The content that is read has no view
+    CHECK(tar.chunk(1536, 10).empty());
+
+    const auto archive = readAll(mapped, 1 << 20);
+    for (const size_t length : {size_t{7}, size_t{512}, size_t{1} << 20}) {
+        std::vector<char> buffer(length);
+        std::string res;
+        for (auto part = tar.read(0, buffer); !part.empty(); part = tar.read(res.size(), buffer)) {
+            res.append(part.data(), part.size());
+        }
+        CHECK(res == archive);
+    }
+
+    // A file that can not be read ends the archive early
+    TarStream failing;
+    failing.add("large.zip", Time{}, large.size(),
+                [](std::uint64_t, std::span<char>) { return std::size_t{0}; });
+    std::vector<char> buffer(100);
+    CHECK(failing.read(0, buffer).size() == 100);
+    CHECK(failing.read(512, buffer).empty());
+}
+
+TEST_CASE("TarStream of no files is an empty archive", "[tar]") {
+    const TarStream tar;
+    CHECK(tar.size() == 1024);
+    const auto archive = readAll(tar, 100);
+    CHECK(archive == std::string(1024, '\0'));
+}
+
+// ============================================================================
+// TarParser
+// ============================================================================
+
+namespace {
+
+struct Parsed {
+    std::vector<std::pair<std::string, std::string>> files;
+    TarParser parser{[this](const TarEntry& entry) { files.emplace_back(entry.name, ""); },
+                     [this](std::span<const char> data) {
+                         files.back().second.append(data.data(), data.size());
+                     },
+                     [] {}};
+};
+
+}  // namespace
+
+TEST_CASE("TarParser reads a tar stream in pieces", "[tar]") {
+    const std::string small = "abc";
+    const std::string large(5000, 'x');
+    TarStream tar;
+    tar.add("small.zip", Time{}, small);
+    tar.add("dir/large.zip", Time{}, large);
+    tar.add("empty.zip", Time{}, {});
+    const auto archive = readAll(tar, 1 << 20);
+
+    for (const size_t piece : {size_t{1}, size_t{100}, size_t{512}, archive.size()}) {
+        Parsed parsed;
+        for (size_t i = 0; i < archive.size(); i += piece) {
+            parsed.parser.feed(std::span{archive}.subspan(i, std::min(piece, archive.size() - i)));
+        }
+        CHECK(parsed.parser.done());
+        REQUIRE(parsed.files.size() == 3);
+        CHECK(parsed.files[0] == std::pair<std::string, std::string>{"small.zip", small});
+        CHECK(parsed.files[1] == std::pair<std::string, std::string>{"dir/large.zip", large});
+        CHECK(parsed.files[2] == std::pair<std::string, std::string>{"empty.zip", ""});
+    }
+}
+
+TEST_CASE("TarParser detects broken streams", "[tar]") {
+    TarStream tar;
+    tar.add("file.zip", Time{}, std::string_view{"content"});
+    auto archive = readAll(tar, 1 << 20);
+
+    SECTION("corrupt header") {
+        archive[10] = 'x';
+        Parsed parsed;
+        CHECK_THROWS(parsed.parser.feed(archive));
+    }
+    SECTION("truncated") {
+        Parsed parsed;
+        parsed.parser.feed(std::span{archive}.first(515));
+        CHECK_FALSE(parsed.parser.done());
+        CHECK_FALSE(parsed.parser.atBoundary());
+    }
+    SECTION("without end blocks") {
+        Parsed parsed;
+        parsed.parser.feed(std::span{archive}.first(1024));
+        CHECK_FALSE(parsed.parser.done());
+        CHECK(parsed.parser.atBoundary());
+    }
+}
+
+TEST_CASE("TarParser applies GNU long names to the next file", "[tar]") {
+    const auto padded = [](std::string data) {
+        data.resize((data.size() + tarBlockSize - 1) / tarBlockSize * tarBlockSize, '\0');
+        return data;
+    };
+    const auto longName = std::string(150, 'd') + "/" + std::string(64, 'a') + ".zip";
+    const std::string content = "content";
+
+    auto link = tarHeader("././@LongLink", longName.size() + 1, Time{});
+    link[156] = 'L';
+    const auto sum = fmt::format("{:06o}", checksum(link));
+    std::copy(sum.begin(), sum.end(), link.begin() + 148);
+    link[154] = '\0';
+    link[155] = ' ';
+
+    const auto header = tarHeader("truncated.zip", content.size(), Time{});
+    const auto archive = std::string{link.data(), link.size()} + padded(longName + '\0') +
+                         std::string{header.data(), header.size()} + padded(content) +
+                         std::string(2 * tarBlockSize, '\0');
+
+    Parsed parsed;
+    parsed.parser.feed(archive);
+    CHECK(parsed.parser.done());
+    REQUIRE(parsed.files.size() == 1);
+    CHECK(parsed.files[0] == std::pair<std::string, std::string>{longName, content});
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vcpkg-cache-server/functional.hpp>
+#include <vcpkg-cache-server/sha.hpp>
+
+#include <libzippp.h>
+#include <spdlog/spdlog.h>
+#include <fmt/format.h>
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace vcache::test {
+
+// A temporary directory that is removed when it goes out of scope
+struct TempDir {
+    TempDir() {
+        static std::atomic<size_t> counter = 0;
+        path = std::filesystem::temp_directory_path() /
+               fmt::format("vcache-test-{}-{}", fp::processId(), counter++);
+        std::filesystem::remove_all(path);
+        std::filesystem::create_directories(path);
+    }
+    ~TempDir() {
+        std::error_code ec;
+        std::filesystem::remove_all(path, ec);
+    }
+    TempDir(const TempDir&) = delete;
+    TempDir& operator=(const TempDir&) = delete;
+
+    std::filesystem::path path;
+};
+
+inline std::shared_ptr<spdlog::logger> testLogger() {
+    return std::make_shared<spdlog::logger>("test");
+}
+
+// Make a sha with a varying prefix so the caches spread over the sub directories
+inline std::string testSha(size_t i) {
+    return fmt::format("{:02x}{:062x}", (i * 37) % 256, i);
+}
+
+inline Sha testKey(size_t i) { return *Sha::parse(testSha(i)); }
+
+// Write a minimal vcpkg cache zip file to root/<sha[0:2]>/<sha>.zip
+inline std::filesystem::path makeCache(const std::filesystem::path& root, std::string_view sha,
+                                std::string_view package, std::string_view version = "1.0.0",
+                                std::string_view arch = "x64-linux") {
+    const auto path = root / sha.substr(0, 2) / fmt::format("{}.zip", sha);
+    std::filesystem::create_directories(path.parent_path());
+
+    const auto control =
+        fmt::format("Package: {}\nVersion: {}\nArchitecture: {}\n", package, version, arch);
+    const auto abi = fmt::format("cmake 3.30.1\ncompiler abc123\nportfile.cmake {}\ntriplet {}\n",
+                                 sha.substr(0, 8), arch);
+
+    libzippp::ZipArchive zf{path.generic_string()};
+    zf.open(libzippp::ZipArchive::New);
+    zf.addData("CONTROL", control.data(), control.size());
+    zf.addData(fmt::format("share/{}/vcpkg_abi_info.txt", package), abi.data(), abi.size());
+    zf.close();
+
+    return path;
+}
+
+inline std::string readFile(const std::filesystem::path& path) {
+    std::ifstream file{path, std::ios_base::binary};
+    return std::string{std::istreambuf_iterator<char>{file}, {}};
+}
+
+}  // namespace vcache::test
@@ -115,6 +115,11 @@ TEST_CASE("Duration YAML parsing handles time units", "[yaml][duration]") {
         auto result = node.as<seconds>();
         CHECK(result == seconds{60});
     }
+    SECTION("parse milliseconds") {
+        YAML::Node node = YAML::Load("1s 250ms");
+        auto result = node.as<milliseconds>();
+        CHECK(result == milliseconds{1250});
+    }
 }
 
 TEST_CASE("Duration YAML parsing rejects invalid input", "[yaml][duration]") {
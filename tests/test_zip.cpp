@@ -0,0 +1,157 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <vcpkg-cache-server/zip.hpp>
+
+#include "test_utils.hpp"
+
+#include <libzippp.h>
+#include <fmt/format.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace vcache;
+using namespace vcache::test;
+
+namespace {
+
+// Write a zip with count small entries followed by the given files
+std::filesystem::path makeZip(const std::filesystem::path& path, size_t count,
+                              const std::vector<std::pair<std::string, std::string>>& files) {
+    std::vector<std::string> data;
+    data.reserve(count);
+    libzippp::ZipArchive zf{path.generic_string()};
+    zf.open(libzippp::ZipArchive::New);
+    for (size_t i = 0; i < count; ++i) {
+        data.push_back(fmt::format("content of file {}", i));
+        zf.addData(fmt::format("include/dir{}/file{}.h", i % 100, i), data.back().data(),
+                   data.back().size());
+    }
+    for (const auto& [name, content] : files) {
+        zf.addData(name, content.data(), content.size());
+    }
+    zf.close();
+    return path;
+}
+
+}  // namespace
+
+// ============================================================================
+// ZipReader
+// ============================================================================
+
+TEST_CASE("ZipReader reads entries by name", "[zip]") {
+    TempDir dir;
+    const auto path = makeCache(dir.path, testSha(1), "zlib", "1.3.1", "x64-linux");
+
+    // Mapped and read like on a network file system
+    for (const bool map : {true, false}) {
+        const ZipReader zip{path, map};
+        CHECK(zip.size() == 2);
+
+        const auto ctrl = zip.find("CONTROL");
+        REQUIRE(ctrl);
+        CHECK(zip.read(*ctrl) == "Package: zlib\nVersion: 1.3.1\nArchitecture: x64-linux\n");
+
+        const auto abi = zip.findIf(fp::endsWith("vcpkg_abi_info.txt"));
+        REQUIRE(abi);
+        CHECK(abi->name == "share/zlib/vcpkg_abi_info.txt");
+        CHECK(zip.read(*abi).starts_with("cmake 3.30.1\n"));
+
+        CHECK_FALSE(zip.find("share/curl/vcpkg_abi_info.txt"));
+    }
+}
+
+TEST_CASE("ZipReader handles zip64 archives", "[zip]") {
+    TempDir dir;
+    // More than 65535 entries require the zip64 end of central directory
+    const auto large = std::string(100'000, 'x');
+    const auto path = makeZip(dir.path / "large.zip", 70'000, {{"CONTROL", large}});
+
+    for (const bool map : {true, false}) {
+        const ZipReader zip{path, map};
+        CHECK(zip.size() == 70'001);
+        const auto ctrl = zip.find("CONTROL");
+        REQUIRE(ctrl);
+        CHECK(ctrl->compressedSize < ctrl->size);
+        CHECK(zip.read(*ctrl) == large);
+        REQUIRE(zip.find("include/dir42/file69942.h"));
+        CHECK(zip.read(*zip.find("include/dir42/file69942.h")) == "content of file 69942");
+    }
+}
+
+TEST_CASE("ZipReader rejects invalid files", "[zip]") {
+    TempDir dir;
+    const auto path = makeCache(dir.path, testSha(1), "zlib");
+
+    std::ofstream{dir.path / "invalid.zip"} << "not a zip file";
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 10);
+
+    for (const bool map : {true, false}) {
+        CHECK_THROWS(ZipReader{dir.path / "invalid.zip", map});
+        CHECK_THROWS(ZipReader{path, map});
+        CHECK_THROWS(ZipReader{dir.path / "missing.zip", map});
+    }
+}
+
+TEST_CASE("ZipReader that does not map the file detects a file truncated after opening",
+          "[zip]") {
+    TempDir dir;
+    const auto path = makeCache(dir.path, testSha(1), "zlib");
+    const ZipReader zip{path, false};
+    const auto ctrl = zip.find("CONTROL");
+    REQUIRE(ctrl);
+
+    // A mapping would fault reading the entry, the reader throws instead
+    std::filesystem::resize_file(path, ctrl->localOffset + 10);
+    CHECK_THROWS(zip.read(*ctrl));
+}
+
+// ============================================================================
+// Benchmarks, run with: vcpkg-cache-server-tests [benchmark]
+// ============================================================================
+
+TEST_CASE("ZipReader compared to libzippp", "[.][benchmark]") {
+    TempDir dir;
+    // A large port where the abi info is not at the expected location, forcing a search of all
+    // the entries
+    const auto path = makeZip(dir.path / "large.zip", 50'000,
+                              {{"CONTROL", "Package: qtbase\nVersion: 6.8.0\n"},
+                               {"share/qt/vcpkg_abi_info.txt", "cmake 3.30.1\n"}});
+
+    constexpr size_t rounds = 20;
+    const auto time = [&](auto&& func) {
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < rounds; ++i) {
+            CHECK(func() == "cmake 3.30.1\n");
+        }
+        const std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        return elapsed.count() / static_cast<double>(rounds);
+    };
+
+    const auto fast = time([&]() {
+        const ZipReader zip{path};
+        zip.read(*zip.find("CONTROL"));
+        auto abi = zip.find("share/qtbase/vcpkg_abi_info.txt");
+        if (!abi) abi = zip.findIf(fp::endsWith("vcpkg_abi_info.txt"));
+        return zip.read(*abi);
+    });
+    const auto slow = time([&]() {
+        libzippp::ZipArchive zf{path.generic_string()};
+        zf.open(libzippp::ZipArchive::ReadOnly);
+        zf.getEntry("CONTROL").readAsText();
+        auto abi = zf.getEntry("share/qtbase/vcpkg_abi_info.txt");
+        if (abi.isNull()) {
+            for (const auto& entry : zf.getEntries()) {
+                if (entry.getName().ends_with("vcpkg_abi_info.txt")) abi = entry;
+            }
+        }
+        return abi.readAsText();
+    });
+    fmt::print("ZipReader: {:.2f}ms libzippp: {:.2f}ms per archive\n", fast, slow);
+}